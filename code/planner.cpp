@@ -3,12 +3,26 @@
  * planner.c
  *
  *=================================================================*/
+#include <algorithm> // for find, sort, partial_sort
 #include <ctime>
+#include <limits.h> // for INT_MAX
 #include <math.h> // for pow, sqrt, round
 #include <map>
 #include <queue>
+#include <stdint.h> // for uint64_t
+#include <stdio.h> // for fopen, fwrite, rename
 #include <stdlib.h> // for rand
+#include <string.h> // for memset
 #include <vector>
+#if !defined(_WIN32)
+#include <fcntl.h> // for open
+#include <sys/mman.h> // for mmap
+#include <sys/stat.h> // for fstat
+#include <unistd.h> // for close
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 #include "mex.h"
 
 using namespace std;
@@ -18,6 +32,7 @@ using namespace std;
 #define	ARMSTART_IN	prhs[1]
 #define	ARMGOAL_IN     prhs[2]
 #define	PLANNER_ID_IN     prhs[3]
+#define	ROADMAP_FILE_IN     prhs[4]
 
 /* Planner Ids */
 #define RRT         0
@@ -46,6 +61,145 @@ using namespace std;
 //the length of each link in the arm (should be the same as the one used in runtest.m)
 #define LINKLENGTH_CELLS 10
 
+/* Edge checking strategies for isJointTransitionValid */
+#define EDGE_CHECK_LINEAR      0
+#define EDGE_CHECK_SAFEBALL    1
+#define EDGE_CHECK_BATCHED     2
+#define EDGE_CHECK_INCREMENTAL 3
+#define EDGE_CHECK_BISECTION   4
+
+#define EDGE_CHECK EDGE_CHECK_SAFEBALL
+
+/* Nearest neighbour backends for the planners' node queries */
+#define NN_LINEAR 0 // scan every node
+#define NN_KDTREE 1 // incremental KD-tree
+#define NN_SCAN   2 // vectorized scan over joints stored joint by joint
+#define NN_VPTREE 3 // vantage point tree, works with any metric
+
+#define NN_BACKEND NN_VPTREE
+
+//indexes with fewer nodes than this are scanned even with the tree backends
+#define NN_SCAN_MAX_SIZE 256
+
+//when set, RRT and RRTConnect look for nearest nodes in a grid hash over the joint
+//angles, probing only the cells within NN_APPROX_PROBE_RADIUS cells of the query's
+//cell in every joint; the nearest node found there may not be the true nearest one.
+//Larger radii raise the recall at the cost of probing (2r+1)^DOF cells per query.
+#define NN_APPROXIMATE 0
+#define NN_APPROX_PROBE_RADIUS 1
+//side of a grid cell, in steps of the getAngleDiscretizationFactor lattice
+#define NN_APPROX_CELL_STEPS 32
+//every this many approximate queries is also answered exactly to measure the recall
+#define NN_RECALL_SAMPLE_INTERVAL 16
+
+//the vantage point tree is rebuilt once more than VP_TREE_MIN_BUFFER points and
+//more than 1/VP_TREE_BUFFER_DIVISOR of its size were added since the last build
+#define VP_TREE_MIN_BUFFER 64
+#define VP_TREE_BUFFER_DIVISOR 8
+
+/* Searches PRM runs over its roadmap to extract a path */
+#define PRM_SEARCH_BFS      0 // fewest edges
+#define PRM_SEARCH_DIJKSTRA 1 // shortest in joint space
+#define PRM_SEARCH_ASTAR    2 // shortest in joint space, guided by the distance to the goal
+
+#define PRM_SEARCH PRM_SEARCH_ASTAR
+
+/* Which nodes PRM tries to connect a new sample to */
+#define PRM_CONNECT_RADIUS              0 // every node within getRRTStarRadius
+#define PRM_CONNECT_KNEAREST            1 // the k nearest nodes, k-PRM*
+#define PRM_CONNECT_KNEAREST_SYMMETRIC  2 // the k nearest that also have the sample among their own k nearest
+
+#define PRM_CONNECTION PRM_CONNECT_KNEAREST
+
+//when set, PRM keeps a sparse roadmap spanner in the style of SPARS: a valid sample
+//is only added if no node sees it within the visibility radius, if it joins
+//components, or if it shortens a path between two nodes it sees by more than the
+//stretch factor.  PRM_CONNECTION is not used then.
+#define PRM_SPARSE 0
+#define SPARSE_STRETCH_FACTOR 3.0
+//visibility radius as a fraction of the joint space diameter, 2 pi sqrt(numofDOFs)
+#define SPARSE_VISIBILITY_FRACTION 0.1
+
+//when set, PRM keeps its roadmap between mex calls on the same map, so that later
+//queries only connect their start and goal to it (and grow it if that is not enough)
+#define PERSISTENT_ROADMAP 1
+//a persistent roadmap stops sampling past this many nodes, so queries it cannot
+//answer fail right away instead of growing it until TIMELIMIT
+#define PERSISTENT_ROADMAP_MAX_NODES 20000
+
+/* Roadmap files (see saveRoadmapFile) */
+#define ROADMAP_FILE_MAGIC "ARMPRM\0\0"
+#define ROADMAP_FILE_VERSION 1
+
+//when set, RRT* samples only the joints that could still shorten its solution
+//once it has one (Informed RRT*), instead of all of [0, 2pi)^numofDOFs
+#define INFORMED_RRTSTAR 1
+
+//when set, RRT, RRT* and PRM add edges without checking them and only validate
+//the edges of a candidate solution path, cutting the colliding ones and searching again
+#define LAZY_EDGE_VALIDATION 0
+
+//how far (in cells) the center of a cell visited by Bresenham can lie from the
+//continuous segment it rasterizes
+#define BRESENHAM_MARGIN_CELLS (0.5 + 0.70710678)
+//spacing (in cells) of the clearance lookups taken along a link
+#define CLEARANCE_SAMPLE_SPACING 2
+
+//number of configurations IsValidArmConfigurationBatch pushes through forward
+//kinematics together (a multiple of the SIMD width)
+#define FK_BATCH_SIZE 32
+
+//number of rotation updates the incremental edge checker applies to the link
+//directions before recomputing them with cos/sin, which bounds rounding drift
+#define FK_RESEED_INTERVAL 32
+
+/* Eviction policies of the configuration cache */
+#define CACHE_EVICT_NONE 0 // a full probe window drops the new entry
+#define CACHE_EVICT_FIFO 1 // a full probe window replaces its oldest entry
+#define CACHE_EVICT_LRU  2 // a full probe window replaces its least recently used entry
+
+//number of entries (a power of two) in the cache of configuration checks, 0 disables it.
+//The cache answers with the validity of the closest configuration on the
+//getAngleDiscretizationFactor lattice, so it gives up exactness below that resolution.
+#define CONFIG_CACHE_SIZE 0
+//number of consecutive slots a key may occupy in the cache
+#define CONFIG_CACHE_PROBES 8
+#define CONFIG_CACHE_EVICTION CACHE_EVICT_LRU
+
+//number of slots (a power of two) in the cache of checked arm prefixes, 0 disables it
+#define PREFIX_CACHE_SIZE 4096
+
+//number of max-pooled levels above the occupancy grid; level l has blocks of
+//2^l x 2^l cells.  0 disables the coarse acceptance of segments.
+#define OCCUPANCY_PYRAMID_LEVELS 5
+
+//size in bytes of the first block the arena of a planning run takes from the
+//heap; every later block is twice as large as the one before
+#define ARENA_BLOCK_SIZE 65536
+
+//number of edges per block in the edge lists of a growing PRM roadmap
+#define ROADMAP_EDGE_BLOCK 4
+//overlay nodes a roadmap can hold for a query, its start and goal
+#define ROADMAP_OVERLAY_NODES 2
+
+//the planners and distance kernels are instantiated for 2 to 10 joints so that
+//joint loops have a compile-time trip count; 0 is the dynamic instantiation
+//used for any other joint count
+#define FIXED_DOFS(DOF, numofDOFs) ((DOF) > 0 ? (DOF) : (numofDOFs))
+#define DISPATCH_ON_DOF(numofDOFs, function, args) \
+    switch (numofDOFs) { \
+        case 2: return function<2> args; \
+        case 3: return function<3> args; \
+        case 4: return function<4> args; \
+        case 5: return function<5> args; \
+        case 6: return function<6> args; \
+        case 7: return function<7> args; \
+        case 8: return function<8> args; \
+        case 9: return function<9> args; \
+        case 10: return function<10> args; \
+        default: return function<0> args; \
+    }
+
 #ifdef _BLAS64_
 #define int_F ptrdiff_t
 #else
@@ -64,6 +218,290 @@ typedef struct {
   int Flipped;
 } bresenham_param_t;
 
+// The obstacle map as seen by the collision checker.  The MATLAB map is kept
+// for reference, but all checks read the bit-packed occupancy grid: one bit per
+// cell, with every row (fixed Y) starting on a fresh 64-bit word.
+// clearance holds, for every cell, the Euclidean distance (in cells) from its
+// center to the center of the closest obstacle cell.
+// occupancyPyramid[l - 1] marks, for level l, which 2^l x 2^l blocks of cells
+// contain an obstacle (pyramidWidth[l - 1] blocks per row).
+// linkRasterStart/linkRasterCells hold the cells Bresenham visits for every
+// cell displacement a link can span (see buildLinkRasterTable).
+// stats counts the collision checking work of the current planning run.
+typedef struct {
+  long edgeChecks;       // calls to isJointTransitionValid
+  long edgeSteps;        // interpolation steps on those edges
+  long edgeStepsChecked; // steps that were actually checked (or certified)
+  long configCacheHits;
+  long configCacheMisses;
+  long configCacheEvictions;
+  long prefixLinksReused; // links whose check was taken from the prefix cache
+} CollisionStats;
+
+// Bounded open addressing cache of configuration checks, keyed on the lattice
+// indices of the joint angles.  A key of 0 marks an empty slot.
+typedef struct {
+  int numofDOFs;
+  int discretizationFactor;
+  int capacity;
+  uint64_t* keys;
+  unsigned short* lattice;  // numofDOFs lattice indices per slot
+  unsigned int* stamps;     // insertion or last use time, for eviction
+  unsigned char* valid;
+  unsigned int clock;
+  unsigned short* queryLattice;
+  double* queryJoint;
+} ConfigCache;
+
+// Direct mapped cache of arm prefixes: a slot holds the first length joint
+// angles of a checked configuration, where link length-1 ends and whether
+// links 0..length-1 are collision free.  A key of 0 marks an empty slot.
+typedef struct {
+  int numofDOFs;
+  int capacity;
+  uint64_t* keys;
+  int* lengths;
+  double* joints;    // numofDOFs angles per slot
+  double* endpoints; // x and y per slot
+  unsigned char* valid;
+} PrefixCache;
+
+typedef struct {
+  double* map;
+  int x_size, y_size;
+  uint64_t* occupancy;
+  int wordsPerRow;
+  float* clearance;
+  unsigned char* occupancyPyramid[OCCUPANCY_PYRAMID_LEVELS + 1];
+  int pyramidWidth[OCCUPANCY_PYRAMID_LEVELS + 1];
+  int* linkRasterStart;
+  short* linkRasterCells;
+  ConfigCache* configCache;
+  PrefixCache* prefixCache;
+  double* edgeScratch; // interpolated joints of the edge checkers, see getEdgeScratch
+  int edgeScratchSize;
+  CollisionStats stats;
+} WorldMap;
+
+//largest cell displacement along x or y covered by the link raster table
+#define LINK_RASTER_RADIUS (LINKLENGTH_CELLS + 1)
+#define LINK_RASTER_WIDTH (2 * LINK_RASTER_RADIUS + 1)
+
+static inline int isCellOccupied(WorldMap* worldMap, int x, int y)
+{
+  return (worldMap->occupancy[y * worldMap->wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+}
+
+#define DT_INFINITY 1e20
+
+// One dimensional squared Euclidean distance transform of the sampled function f
+// (Felzenszwalb & Huttenlocher).  v and z are scratch arrays of n and n+1 entries.
+static void distanceTransform1D(double* f, int n, double* d, int* v, double* z)
+{
+  int k = 0;
+  v[0] = 0;
+  z[0] = -DT_INFINITY;
+  z[1] = DT_INFINITY;
+  for (int q = 1; q < n; q++) {
+    double s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+    while (s <= z[k]) {
+      k--;
+      s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = DT_INFINITY;
+  }
+  k = 0;
+  for (int q = 0; q < n; q++) {
+    while (z[k + 1] < q)
+      k++;
+    d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+  }
+}
+
+// Fills worldMap->clearance with the exact Euclidean distance transform of the
+// occupancy grid (separable, one pass over the rows and one over the columns)
+static void computeClearanceMap(WorldMap* worldMap)
+{
+  int x_size = worldMap->x_size;
+  int y_size = worldMap->y_size;
+  int n = MAX(x_size, y_size);
+  double* grid = (double*) malloc(x_size * y_size * sizeof(double));
+  double* f = (double*) malloc(n * sizeof(double));
+  double* d = (double*) malloc(n * sizeof(double));
+  int* v = (int*) malloc(n * sizeof(int));
+  double* z = (double*) malloc((n + 1) * sizeof(double));
+
+  for (int y = 0; y < y_size; y++) {
+    for (int x = 0; x < x_size; x++)
+      f[x] = isCellOccupied(worldMap, x, y) ? 0 : DT_INFINITY;
+    distanceTransform1D(f, x_size, d, v, z);
+    for (int x = 0; x < x_size; x++)
+      grid[GETMAPINDEX(x,y,x_size,y_size)] = d[x];
+  }
+
+  worldMap->clearance = (float*) malloc(x_size * y_size * sizeof(float));
+  for (int x = 0; x < x_size; x++) {
+    for (int y = 0; y < y_size; y++)
+      f[y] = grid[GETMAPINDEX(x,y,x_size,y_size)];
+    distanceTransform1D(f, y_size, d, v, z);
+    for (int y = 0; y < y_size; y++)
+      worldMap->clearance[GETMAPINDEX(x,y,x_size,y_size)] = sqrt(d[y]);
+  }
+  free(grid);
+  free(f);
+  free(d);
+  free(v);
+  free(z);
+}
+
+static void buildLinkRasterTable(WorldMap* worldMap);
+
+// Builds every level of the occupancy pyramid by max pooling 2 x 2 blocks of
+// the level below it
+static void buildOccupancyPyramid(WorldMap* worldMap)
+{
+  int width = worldMap->x_size;
+  int height = worldMap->y_size;
+  for (int l = 1; l <= OCCUPANCY_PYRAMID_LEVELS; l++) {
+    int coarseWidth = (width + 1) / 2;
+    int coarseHeight = (height + 1) / 2;
+    unsigned char* coarse = (unsigned char*) calloc(coarseWidth * coarseHeight, sizeof(unsigned char));
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        int occupied = (l == 1) ? isCellOccupied(worldMap, x, y)
+                : worldMap->occupancyPyramid[l - 2][y * width + x];
+        if (occupied)
+          coarse[(y / 2) * coarseWidth + x / 2] = 1;
+      }
+    }
+    worldMap->occupancyPyramid[l - 1] = coarse;
+    worldMap->pyramidWidth[l - 1] = coarseWidth;
+    width = coarseWidth;
+    height = coarseHeight;
+  }
+}
+
+// Builds the occupancy grid for map once, so that planners don't have to touch
+// the 8-byte doubles of the MATLAB map on every Bresenham step
+WorldMap* createWorldMap(double* map, int x_size, int y_size)
+{
+  WorldMap* worldMap = (WorldMap*) malloc(sizeof(WorldMap));
+  worldMap->map = map;
+  worldMap->x_size = x_size;
+  worldMap->y_size = y_size;
+  worldMap->wordsPerRow = (x_size + 63) / 64;
+  worldMap->occupancy = (uint64_t*) calloc(worldMap->wordsPerRow * y_size, sizeof(uint64_t));
+  for (int y = 0; y < y_size; y++) {
+    uint64_t* row = worldMap->occupancy + y * worldMap->wordsPerRow;
+    for (int x = 0; x < x_size; x++) {
+      if (map[GETMAPINDEX(x,y,x_size,y_size)] == 1)
+        row[x >> 6] |= ((uint64_t) 1) << (x & 63);
+    }
+  }
+  computeClearanceMap(worldMap);
+  buildOccupancyPyramid(worldMap);
+  buildLinkRasterTable(worldMap);
+  worldMap->configCache = 0;
+  worldMap->prefixCache = 0;
+  worldMap->edgeScratch = 0;
+  worldMap->edgeScratchSize = 0;
+  memset(&worldMap->stats, 0, sizeof(CollisionStats));
+  return worldMap;
+}
+
+// Hash of the size and the occupied cells of worldMap, which tells whether a
+// roadmap built for one map can be used on another
+uint64_t hashWorldMap(WorldMap* worldMap)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  hash = (hash ^ (uint64_t) worldMap->x_size) * 1099511628211ULL;
+  hash = (hash ^ (uint64_t) worldMap->y_size) * 1099511628211ULL;
+  for (int i = 0; i < worldMap->wordsPerRow * worldMap->y_size; i++) {
+    hash = (hash ^ worldMap->occupancy[i]) * 1099511628211ULL;
+  }
+  return hash ^ (hash >> 29);
+}
+
+ConfigCache* createConfigCache(int numofDOFs, int discretizationFactor, int capacity)
+{
+  ConfigCache* cache = (ConfigCache*) malloc(sizeof(ConfigCache));
+  cache->numofDOFs = numofDOFs;
+  cache->discretizationFactor = discretizationFactor;
+  cache->capacity = capacity;
+  cache->keys = (uint64_t*) calloc(capacity, sizeof(uint64_t));
+  cache->lattice = (unsigned short*) malloc(capacity * numofDOFs * sizeof(unsigned short));
+  cache->stamps = (unsigned int*) malloc(capacity * sizeof(unsigned int));
+  cache->valid = (unsigned char*) malloc(capacity * sizeof(unsigned char));
+  cache->clock = 0;
+  cache->queryLattice = (unsigned short*) malloc(numofDOFs * sizeof(unsigned short));
+  cache->queryJoint = (double*) malloc(numofDOFs * sizeof(double));
+  return cache;
+}
+
+void freeConfigCache(ConfigCache* cache)
+{
+  free(cache->keys);
+  free(cache->lattice);
+  free(cache->stamps);
+  free(cache->valid);
+  free(cache->queryLattice);
+  free(cache->queryJoint);
+  free(cache);
+}
+
+PrefixCache* createPrefixCache(int numofDOFs, int capacity)
+{
+  PrefixCache* cache = (PrefixCache*) malloc(sizeof(PrefixCache));
+  cache->numofDOFs = numofDOFs;
+  cache->capacity = capacity;
+  cache->keys = (uint64_t*) calloc(capacity, sizeof(uint64_t));
+  cache->lengths = (int*) malloc(capacity * sizeof(int));
+  cache->joints = (double*) malloc(capacity * numofDOFs * sizeof(double));
+  cache->endpoints = (double*) malloc(2 * capacity * sizeof(double));
+  cache->valid = (unsigned char*) malloc(capacity * sizeof(unsigned char));
+  return cache;
+}
+
+void freePrefixCache(PrefixCache* cache)
+{
+  free(cache->keys);
+  free(cache->lengths);
+  free(cache->joints);
+  free(cache->endpoints);
+  free(cache->valid);
+  free(cache);
+}
+
+void freeWorldMap(WorldMap* worldMap)
+{
+  if (worldMap->configCache)
+    freeConfigCache(worldMap->configCache);
+  if (worldMap->prefixCache)
+    freePrefixCache(worldMap->prefixCache);
+  free(worldMap->occupancy);
+  free(worldMap->clearance);
+  for (int l = 0; l < OCCUPANCY_PYRAMID_LEVELS; l++)
+    free(worldMap->occupancyPyramid[l]);
+  free(worldMap->linkRasterStart);
+  free(worldMap->linkRasterCells);
+  free(worldMap->edgeScratch);
+  free(worldMap);
+}
+
+// Returns room for size doubles that the edge checkers reuse for every edge,
+// instead of allocating their interpolated joints on each call
+static double* getEdgeScratch(WorldMap* worldMap, int size)
+{
+  if (size > worldMap->edgeScratchSize) {
+    worldMap->edgeScratchSize = size;
+    worldMap->edgeScratch = (double*) realloc(worldMap->edgeScratch, size * sizeof(double));
+  }
+  return worldMap->edgeScratch;
+}
+
 // Given continuous x, y returns the discretized grid cell coordinates
 void ContXY2Cell(double x, double y, short unsigned int* pX, short unsigned int *pY, int x_size, int y_size)
 {
@@ -161,12 +599,42 @@ int get_next_point(bresenham_param_t *params)
   return 1;
 }
 
+// Bresenham only depends on the displacement between the end cells, so the
+// cells of any segment are its start cell plus a fixed list of offsets.  Lists
+// the offsets for every displacement up to LINK_RASTER_RADIUS: the cells for
+// displacement (dx, dy) are linkRasterCells[2*k], linkRasterCells[2*k+1] for k
+// in [linkRasterStart[d], linkRasterStart[d+1]) with
+// d = (dy + LINK_RASTER_RADIUS) * LINK_RASTER_WIDTH + dx + LINK_RASTER_RADIUS.
+static void buildLinkRasterTable(WorldMap* worldMap)
+{
+  bresenham_param_t params;
+  int nX, nY;
+  int numDisplacements = LINK_RASTER_WIDTH * LINK_RASTER_WIDTH;
+  worldMap->linkRasterStart = (int*) malloc((numDisplacements + 1) * sizeof(int));
+  worldMap->linkRasterCells = (short*) malloc(2 * numDisplacements * (LINK_RASTER_RADIUS + 1) * sizeof(short));
+  int numCells = 0;
+  for (int dy = -LINK_RASTER_RADIUS; dy <= LINK_RASTER_RADIUS; dy++) {
+    for (int dx = -LINK_RASTER_RADIUS; dx <= LINK_RASTER_RADIUS; dx++) {
+      worldMap->linkRasterStart[(dy + LINK_RASTER_RADIUS) * LINK_RASTER_WIDTH + dx + LINK_RASTER_RADIUS] = numCells;
+      get_bresenham_parameters(0, 0, dx, dy, &params);
+      do {
+        get_current_point(&params, &nX, &nY);
+        worldMap->linkRasterCells[2 * numCells] = nX;
+        worldMap->linkRasterCells[2 * numCells + 1] = nY;
+        numCells++;
+      } while (get_next_point(&params));
+    }
+  }
+  worldMap->linkRasterStart[numDisplacements] = numCells;
+}
 
 // Given a line segment going in continuous space from (x0, y0) to (x1, y1), returns
 // whether the line segment is valid (inside the map and doesn't collide)
-int IsValidLineSegment(double x0, double y0, double x1, double y1, double*	map, int x_size, int y_size) {
+int IsValidLineSegment(double x0, double y0, double x1, double y1, WorldMap* worldMap) {
     
 	bresenham_param_t params;
+	int x_size = worldMap->x_size;
+	int y_size = worldMap->y_size;
 	int nX, nY; 
     short unsigned int nX0, nY0, nX1, nY1;
 
@@ -184,11 +652,41 @@ int IsValidLineSegment(double x0, double y0, double x1, double y1, double*	map,
 
     //printf("checking link <%d %d> to <%d %d>\n", nX0,nY0,nX1,nY1);
 
+	//the cells of the segment lie within the box spanned by its end cells, so
+	//the segment is free if the (at most 2 x 2) blocks of the first pyramid
+	//level as large as the box are
+	int dx = nX1 - nX0;
+	int dy = nY1 - nY0;
+	int extent = MAX(abs(dx), abs(dy));
+	int level = 1;
+	while ((1 << level) <= extent)
+		level++;
+	if (level <= OCCUPANCY_PYRAMID_LEVELS) {
+		unsigned char* blocks = worldMap->occupancyPyramid[level - 1];
+		int width = worldMap->pyramidWidth[level - 1];
+		int bX0 = MIN(nX0, nX1) >> level, bX1 = MAX(nX0, nX1) >> level;
+		int bY0 = MIN(nY0, nY1) >> level, bY1 = MAX(nY0, nY1) >> level;
+		if (!blocks[bY0 * width + bX0] && !blocks[bY0 * width + bX1] &&
+				!blocks[bY1 * width + bX0] && !blocks[bY1 * width + bX1])
+			return 1;
+	}
+
+	//links are short enough to read their cells from the raster table
+	if (abs(dx) <= LINK_RASTER_RADIUS && abs(dy) <= LINK_RASTER_RADIUS) {
+		int d = (dy + LINK_RASTER_RADIUS) * LINK_RASTER_WIDTH + dx + LINK_RASTER_RADIUS;
+		short* cells = worldMap->linkRasterCells;
+		for (int k = worldMap->linkRasterStart[d]; k < worldMap->linkRasterStart[d + 1]; k++) {
+			if(isCellOccupied(worldMap, nX0 + cells[2 * k], nY0 + cells[2 * k + 1]))
+				return 0;
+		}
+		return 1;
+	}
+
 	//iterate through the points on the segment
 	get_bresenham_parameters(nX0, nY0, nX1, nY1, &params);
 	do {
 		get_current_point(&params, &nX, &nY);
-		if(map[GETMAPINDEX(nX,nY,x_size,y_size)] == 1)
+		if(isCellOccupied(worldMap, nX, nY))
             return 0;
 	} while (get_next_point(&params));
 
@@ -197,14 +695,15 @@ int IsValidLineSegment(double x0, double y0, double x1, double y1, double*	map,
 
 // Given a number of arm angles, figures out whether the arm is fully
 // in the map and not colliding with any obstacles.
-int IsValidArmConfiguration(double* angles, int numofDOFs, double*	map,
-		   int x_size, int y_size)
+template <int DOF>
+static int IsValidArmConfigurationDOF(double* angles, int dynamicDOFs, WorldMap* worldMap)
 {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
     double x0,y0,x1,y1;
     int i;
     
  	//iterate through all the links starting with the base
-	x1 = ((double)x_size)/2.0;
+	x1 = ((double)worldMap->x_size)/2.0;
     y1 = 0;
 	for(i = 0; i < numofDOFs; i++)
 	{
@@ -215,13 +714,255 @@ int IsValidArmConfiguration(double* angles, int numofDOFs, double*	map,
 		y1 = y0 - LINKLENGTH_CELLS*sin(2*PI-angles[i]);
 
 		//check the validity of the corresponding line segment
-		if(!IsValidLineSegment(x0,y0,x1,y1,map,x_size,y_size))
+		if(!IsValidLineSegment(x0,y0,x1,y1,worldMap))
 				return 0;
 	}
     return 1;
 }
 
-static void planner(double*	map, int x_size, int y_size, double* armstart_anglesV_rad,
+// IsValidArmConfigurationDOF for callers that are not instantiated per DOF count
+int IsValidArmConfiguration(double* angles, int numofDOFs, WorldMap* worldMap)
+{
+    DISPATCH_ON_DOF(numofDOFs, IsValidArmConfigurationDOF, (angles, numofDOFs, worldMap))
+}
+
+// Extends the hash of a joint prefix by one more angle
+static inline uint64_t hashJointPrefix(uint64_t hash, double angle)
+{
+    uint64_t bits;
+    memcpy(&bits, &angle, sizeof(double));
+    hash = (hash ^ bits) * 1099511628211ULL;
+    return hash ^ (hash >> 29);
+}
+
+// IsValidArmConfiguration that resumes from the longest prefix of angles it
+// has already checked (see PREFIX_CACHE_SIZE).  Prefixes are matched on the
+// exact angles, which lattice samples share often.
+template <int DOF>
+int IsValidArmConfigurationPrefix(double* angles, int dynamicDOFs, WorldMap* worldMap)
+{
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    if (PREFIX_CACHE_SIZE == 0)
+        return IsValidArmConfigurationDOF<DOF>(angles, numofDOFs, worldMap);
+
+    PrefixCache* cache = worldMap->prefixCache;
+    if (cache == 0 || cache->numofDOFs != numofDOFs) {
+        if (cache != 0)
+            freePrefixCache(cache);
+        cache = createPrefixCache(numofDOFs, PREFIX_CACHE_SIZE);
+        worldMap->prefixCache = cache;
+    }
+
+    double x0,y0,x1,y1;
+    uint64_t hash = 14695981039346656037ULL;
+    int i;
+
+    x1 = ((double)worldMap->x_size)/2.0;
+    y1 = 0;
+    //skip the links of the longest cached prefix (the full arm is never cached)
+    for (i = 0; i < numofDOFs - 1; i++) {
+        uint64_t key = hashJointPrefix(hash, angles[i]) | 1;
+        int slot = key & (cache->capacity - 1);
+        if (cache->keys[slot] != key || cache->lengths[slot] != i + 1 ||
+                memcmp(cache->joints + slot * numofDOFs, angles, (i + 1) * sizeof(double)) != 0)
+            break;
+        worldMap->stats.prefixLinksReused++;
+        if (!cache->valid[slot])
+            return 0;
+        hash = hashJointPrefix(hash, angles[i]);
+        x1 = cache->endpoints[2 * slot];
+        y1 = cache->endpoints[2 * slot + 1];
+    }
+
+    for (; i < numofDOFs; i++) {
+        x0 = x1;
+        y0 = y1;
+        x1 = x0 + LINKLENGTH_CELLS*cos(2*PI-angles[i]);
+        y1 = y0 - LINKLENGTH_CELLS*sin(2*PI-angles[i]);
+        int valid = IsValidLineSegment(x0,y0,x1,y1,worldMap);
+
+        hash = hashJointPrefix(hash, angles[i]);
+        if (i < numofDOFs - 1) {
+            uint64_t key = hash | 1;
+            int slot = key & (cache->capacity - 1);
+            cache->keys[slot] = key;
+            cache->lengths[slot] = i + 1;
+            memcpy(cache->joints + slot * numofDOFs, angles, (i + 1) * sizeof(double));
+            cache->endpoints[2 * slot] = x1;
+            cache->endpoints[2 * slot + 1] = y1;
+            cache->valid[slot] = valid;
+        }
+        if (!valid)
+            return 0;
+    }
+    return 1;
+}
+
+#if defined(__AVX2__)
+// Cody-Waite split of pi/2 and the Cephes minimax coefficients for sin and cos on [-pi/4, pi/4]
+#define SINCOS_PIO2_1 1.57079625129699707031
+#define SINCOS_PIO2_2 7.54978941586159635335E-8
+#define SINCOS_PIO2_3 5.39030285815811905290E-15
+
+// Computes sin and cos of four angles at once
+static inline void sincos4(__m256d x, __m256d* sinOut, __m256d* cosOut)
+{
+    const __m256d signBit = _mm256_set1_pd(-0.0);
+    __m256d q = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(2 / 3.14159265358979323846)),
+            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_sub_pd(x, _mm256_mul_pd(q, _mm256_set1_pd(SINCOS_PIO2_1)));
+    r = _mm256_sub_pd(r, _mm256_mul_pd(q, _mm256_set1_pd(SINCOS_PIO2_2)));
+    r = _mm256_sub_pd(r, _mm256_mul_pd(q, _mm256_set1_pd(SINCOS_PIO2_3)));
+    __m256d r2 = _mm256_mul_pd(r, r);
+
+    __m256d ps = _mm256_set1_pd(1.58962301576546568060E-10);
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, r2), _mm256_set1_pd(-2.50507477628578072866E-8));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, r2), _mm256_set1_pd(2.75573136213857245213E-6));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, r2), _mm256_set1_pd(-1.98412698295895385996E-4));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, r2), _mm256_set1_pd(8.33333333332211858878E-3));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, r2), _mm256_set1_pd(-1.66666666666666307295E-1));
+    __m256d s = _mm256_add_pd(r, _mm256_mul_pd(_mm256_mul_pd(r, r2), ps));
+
+    __m256d pc = _mm256_set1_pd(-1.13585365213876817300E-11);
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, r2), _mm256_set1_pd(2.08757008419747316778E-9));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, r2), _mm256_set1_pd(-2.75573141792967388112E-7));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, r2), _mm256_set1_pd(2.48015872888517045348E-5));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, r2), _mm256_set1_pd(-1.38888888888730564116E-3));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, r2), _mm256_set1_pd(4.16666666666665929218E-2));
+    __m256d c = _mm256_sub_pd(_mm256_set1_pd(1.0), _mm256_mul_pd(_mm256_set1_pd(0.5), r2));
+    c = _mm256_add_pd(c, _mm256_mul_pd(_mm256_mul_pd(r2, r2), pc));
+
+    // quadrant = q mod 4, kept in doubles: odd quadrants swap sin and cos,
+    // quadrants 2 and 3 negate sin, quadrants 1 and 2 negate cos
+    __m256d quadrant = _mm256_sub_pd(q, _mm256_mul_pd(_mm256_set1_pd(4.0),
+            _mm256_floor_pd(_mm256_mul_pd(q, _mm256_set1_pd(0.25)))));
+    __m256d half = _mm256_floor_pd(_mm256_mul_pd(quadrant, _mm256_set1_pd(0.5)));
+    __m256d odd = _mm256_sub_pd(quadrant, _mm256_add_pd(half, half));
+    __m256d swap = _mm256_cmp_pd(odd, _mm256_set1_pd(1.0), _CMP_EQ_OQ);
+    __m256d sinNeg = _mm256_cmp_pd(half, _mm256_set1_pd(1.0), _CMP_EQ_OQ);
+    __m256d cosNeg = _mm256_cmp_pd(_mm256_add_pd(odd, half), _mm256_set1_pd(1.0), _CMP_EQ_OQ);
+    *sinOut = _mm256_xor_pd(_mm256_blendv_pd(s, c, swap), _mm256_and_pd(sinNeg, signBit));
+    *cosOut = _mm256_xor_pd(_mm256_blendv_pd(c, s, swap), _mm256_and_pd(cosNeg, signBit));
+}
+#endif
+
+// Moves the end points (x, y) of numConfigs arms one link further, along the
+// link angles angles[0..numConfigs-1]
+static void advanceLinkEndpoints(double* angles, int numConfigs, double* x, double* y)
+{
+    int c = 0;
+#if defined(__AVX2__)
+    const __m256d twoPi = _mm256_set1_pd(2*PI);
+    const __m256d linkLength = _mm256_set1_pd(LINKLENGTH_CELLS);
+    for (; c + 4 <= numConfigs; c += 4) {
+        __m256d sinAngle, cosAngle;
+        sincos4(_mm256_sub_pd(twoPi, _mm256_loadu_pd(angles + c)), &sinAngle, &cosAngle);
+        _mm256_storeu_pd(x + c, _mm256_add_pd(_mm256_loadu_pd(x + c), _mm256_mul_pd(linkLength, cosAngle)));
+        _mm256_storeu_pd(y + c, _mm256_sub_pd(_mm256_loadu_pd(y + c), _mm256_mul_pd(linkLength, sinAngle)));
+    }
+#endif
+    for (; c < numConfigs; c++) {
+        x[c] = x[c] + LINKLENGTH_CELLS*cos(2*PI-angles[c]);
+        y[c] = y[c] - LINKLENGTH_CELLS*sin(2*PI-angles[c]);
+    }
+}
+
+// Checks numConfigs (at most FK_BATCH_SIZE) configurations stored joint by joint:
+// angles[j * stride + c] is joint j of configuration c
+template <int DOF>
+static void IsValidArmConfigurationBatchChunk(double* angles, int stride, int numConfigs, int dynamicDOFs,
+        WorldMap* worldMap, unsigned char* valid)
+{
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double x0[FK_BATCH_SIZE], y0[FK_BATCH_SIZE], x1[FK_BATCH_SIZE], y1[FK_BATCH_SIZE];
+    for (int c = 0; c < numConfigs; c++) {
+        x1[c] = ((double)worldMap->x_size)/2.0;
+        y1[c] = 0;
+        valid[c] = 1;
+    }
+    for (int i = 0; i < numofDOFs; i++) {
+        for (int c = 0; c < numConfigs; c++) {
+            x0[c] = x1[c];
+            y0[c] = y1[c];
+        }
+        advanceLinkEndpoints(angles + i * stride, numConfigs, x1, y1);
+        for (int c = 0; c < numConfigs; c++) {
+            if (valid[c] && !IsValidLineSegment(x0[c],y0[c],x1[c],y1[c],worldMap))
+                valid[c] = 0;
+        }
+    }
+}
+
+// Batched IsValidArmConfiguration: angles holds numConfigs configurations in
+// structure-of-arrays layout (angles[j * numConfigs + c] is joint j of
+// configuration c) and valid[c] is set to whether configuration c is collision free
+template <int DOF>
+void IsValidArmConfigurationBatch(double* angles, int numConfigs, int dynamicDOFs, WorldMap* worldMap,
+        unsigned char* valid)
+{
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    for (int c = 0; c < numConfigs; c += FK_BATCH_SIZE) {
+        IsValidArmConfigurationBatchChunk<DOF>(angles + c, numConfigs, MIN(FK_BATCH_SIZE, numConfigs - c),
+                numofDOFs, worldMap, valid + c);
+    }
+}
+
+// Returns a lower bound (in cells) on the distance between the segment from
+// (x0, y0) to (x1, y1) and the center of any obstacle cell.  The clearance map
+// is sampled along the segment; each sample may sit sqrt(2)/2 away from the
+// cell center the map was computed for, and every point of the segment is
+// within half a spacing of a sample.
+static double getLinkClearance(double x0, double y0, double x1, double y1, WorldMap* worldMap)
+{
+    int numSamples = (int) ceil(LINKLENGTH_CELLS / CLEARANCE_SAMPLE_SPACING);
+    double minClearance = DT_INFINITY;
+    short unsigned int nX, nY;
+    for (int k = 0; k <= numSamples; k++) {
+        ContXY2Cell(x0 + ((x1 - x0) * k) / numSamples, y0 + ((y1 - y0) * k) / numSamples,
+                &nX, &nY, worldMap->x_size, worldMap->y_size);
+        double clearance = worldMap->clearance[GETMAPINDEX(nX,nY,worldMap->x_size,worldMap->y_size)];
+        if (clearance < minClearance)
+            minClearance = clearance;
+    }
+    return minClearance - 0.70710678 - (0.5 * LINKLENGTH_CELLS) / numSamples;
+}
+
+// Given a configuration and a unit direction in joint space, returns how far
+// the arm can move along direction while staying inside the map and collision
+// free, or 0 if the clearance map can't even certify angles itself.
+// Links point along absolute angles, so moving the joints by delta displaces
+// every point of link i by at most LINKLENGTH_CELLS * (|delta_0| + ... + |delta_i|).
+template <int DOF>
+static double getSafeJointRadius(double* angles, double* direction, int dynamicDOFs, WorldMap* worldMap)
+{
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double x0,y0,x1,y1;
+    double sweep = 0;
+    double safeRadius = DT_INFINITY;
+
+    x1 = ((double)worldMap->x_size)/2.0;
+    y1 = 0;
+    for (int i = 0; i < numofDOFs; i++) {
+        x0 = x1;
+        y0 = y1;
+        x1 = x0 + LINKLENGTH_CELLS*cos(2*PI-angles[i]);
+        y1 = y0 - LINKLENGTH_CELLS*sin(2*PI-angles[i]);
+
+        // the cells Bresenham visits lie within the box spanned by the end points,
+        // so staying inside the map only depends on where the link ends
+        double boundary = MIN(MIN(x1, worldMap->x_size - x1), MIN(y1, worldMap->y_size - y1));
+        double clearance = getLinkClearance(x0, y0, x1, y1, worldMap) - BRESENHAM_MARGIN_CELLS;
+        if (boundary <= 0 || clearance <= 0)
+            return 0;
+
+        sweep += fabs(direction[i]);
+        if (sweep > 0)
+            safeRadius = MIN(safeRadius, MIN(boundary, clearance) / (LINKLENGTH_CELLS * sweep));
+    }
+    return safeRadius;
+}
+
+static void planner(WorldMap* worldMap, double* armstart_anglesV_rad,
 	double* armgoal_anglesV_rad, int numofDOFs, double*** plan, int* planlength) {
 	//no plan by default
 	*plan = NULL;
@@ -247,7 +988,7 @@ static void planner(double*	map, int x_size, int y_size, double* armstart_angles
         for(j = 0; j < numofDOFs; j++){
             (*plan)[i][j] = armstart_anglesV_rad[j] + ((double)(i)/(numofsamples-1))*(armgoal_anglesV_rad[j] - armstart_anglesV_rad[j]);
         }
-        if(!IsValidArmConfiguration((*plan)[i], numofDOFs, map, x_size, y_size) && firstinvalidconf)
+        if(!IsValidArmConfiguration((*plan)[i], numofDOFs, worldMap) && firstinvalidconf)
         {
             firstinvalidconf = 1;
             printf("ERROR: Invalid arm configuration!!!\n");
@@ -263,6 +1004,9 @@ struct Node {
     Node* parent;
     int nodeNum;
     double cost;
+    int edgeChecked; // whether the edge to parent is known to be collision free
+    Node* firstChild; // children, linked by nextSibling; kept by RRT and RRT* only
+    Node* nextSibling;
 };
 
 struct ExperimentResult {
@@ -270,106 +1014,1855 @@ struct ExperimentResult {
     int numNodes;
     int planLength;
     double planQuality;
+    long numEdgeStepsChecked;
+    long numEdgeStepsSaved;
+    int nnIndexSize;
+    long numNNQueries;
+    double nnQueryTime;
+    double nnRecall; // share of the sampled nearest neighbour queries answered exactly
+    long numArenaAllocations;
+    long numArenaHeapCalls;
+    long arenaBytes;
+    int numRoadmapEdges;
+    long roadmapBytes;
+    long numSearchExpansions;
+    double searchTime;
+    long numPathEdgesChecked;
+    long numPathEdgesReused;
+    long numPathEdgesCut;
+    int numCoverageNodes;
+    int numConnectivityNodes;
+    int numQualityNodes;
+    long numSamplesRejected;
+    double firstSolutionCost; // RRT*, before the tree improves it
 };
 
-static int getAngleDiscretizationFactor(int numofDOFs) {
-    return round((2 * PI) / (2 * asin(sqrt(2)/(2 * LINKLENGTH_CELLS * numofDOFs))));
+// Bump allocator for the nodes and joints of one planning run.  Everything it
+// hands out is released at once by freeArena.
+typedef struct {
+    vector<char*>* blocks;
+    char* top; // next free byte of the newest block
+    size_t remaining; // bytes left in the newest block
+    size_t nextBlockSize;
+    size_t lastSize; // size of the newest allocation, 0 once it was released
+    long allocations;
+    long heapCalls; // blocks taken from the heap
+    long bytes; // bytes handed out and not released
+} Arena;
+
+Arena* createArena() {
+    Arena* arena = (Arena*) malloc(sizeof(Arena));
+    arena->blocks = new vector<char*>();
+    arena->top = 0;
+    arena->remaining = 0;
+    arena->nextBlockSize = ARENA_BLOCK_SIZE;
+    arena->lastSize = 0;
+    arena->allocations = 0;
+    arena->heapCalls = 0;
+    arena->bytes = 0;
+    return arena;
 }
 
-// Given currJoint and joints (all the existing joints),
-// sets closestNeighbor to the joint within joints that's closest to currJoint
-// and also returns the distance between closestNeighbor and currJoint
-double getClosestNeighborFromTree(double* currJoint, vector<Node*>* tree, int numofDOFs, Node** closestNeighbor) {
+void freeArena(Arena* arena) {
+    for (int i = 0; i < arena->blocks->size(); i++) {
+        free((*arena->blocks)[i]);
+    }
+    delete arena->blocks;
+    free(arena);
+}
 
-    double closestNeighborDistance = (pow(2 * PI, 2) * numofDOFs);
+static void* arenaAlloc(Arena* arena, size_t size) {
+    size = (size + 15) & ~((size_t) 15); // keeps every allocation aligned for doubles and pointers
+    if (size > arena->remaining) {
+        size_t blockSize = MAX(arena->nextBlockSize, size);
+        arena->top = (char*) malloc(blockSize);
+        arena->remaining = blockSize;
+        arena->nextBlockSize = 2 * blockSize;
+        arena->blocks->push_back(arena->top);
+        arena->heapCalls++;
+    }
+    void* pointer = arena->top;
+    arena->top += size;
+    arena->remaining -= size;
+    arena->lastSize = size;
+    arena->allocations++;
+    arena->bytes += size;
+    return pointer;
+}
 
-    for (int i = 0; i < tree->size(); i++) {
-        Node* neighbor = (*tree)[i];
-        double* neighborJoint = neighbor->joint;
-        double currNeighborDistance = 0;
-        for (int j = 0; j < numofDOFs; j++) {
-            currNeighborDistance += pow(fabs(neighborJoint[j] - currJoint[j]), 2);
-        }
-        //printf("***neighborJoint is , [%f, %f, %f, %f, %f]\n",
-        //            neighborJoint[0], neighborJoint[1], neighborJoint[2], neighborJoint[3], neighborJoint[4]);
-        if(currNeighborDistance < closestNeighborDistance) {
-            *closestNeighbor = neighbor;
-            closestNeighborDistance = currNeighborDistance;
+// Hands pointer back to arena if it is the newest allocation, as a rejected
+// sample is.  Anything else stays allocated until freeArena.
+static void arenaRelease(Arena* arena, void* pointer) {
+    if (arena->lastSize == 0 || (char*) pointer + arena->lastSize != arena->top)
+        return;
+    arena->top -= arena->lastSize;
+    arena->remaining += arena->lastSize;
+    arena->bytes -= arena->lastSize;
+    arena->lastSize = 0;
+}
+
+static void recordArenaStats(ExperimentResult* result, Arena* arena) {
+    result->numArenaAllocations = arena->allocations;
+    result->numArenaHeapCalls = arena->heapCalls;
+    result->arenaBytes = arena->bytes;
+}
+
+static void resetCollisionStats(WorldMap* worldMap) {
+    memset(&worldMap->stats, 0, sizeof(CollisionStats));
+}
+
+// Copies the collision checking counters of the run into result.  A step is
+// saved when its edge was settled without ever checking it.
+static void recordCollisionStats(ExperimentResult* result, WorldMap* worldMap) {
+    result->numEdgeStepsChecked = worldMap->stats.edgeStepsChecked;
+    result->numEdgeStepsSaved = worldMap->stats.edgeSteps - worldMap->stats.edgeStepsChecked;
+}
+
+static int getAngleDiscretizationFactor(int numofDOFs) {
+    return round((2 * PI) / (2 * asin(sqrt(2)/(2 * LINKLENGTH_CELLS * numofDOFs))));
+}
+
+// Looks up the lattice point in cache->queryLattice (with hash key).  Returns its
+// slot, or -1 on a miss, in which case *insertSlot is set to the slot a new
+// entry should take according to CONFIG_CACHE_EVICTION (-1 to drop it).
+static int findConfigCacheSlot(ConfigCache* cache, uint64_t key, int* insertSlot, WorldMap* worldMap) {
+    int numofDOFs = cache->numofDOFs;
+    int oldestSlot = -1;
+    *insertSlot = -1;
+    for (int probe = 0; probe < CONFIG_CACHE_PROBES; probe++) {
+        int slot = (key + probe) & (cache->capacity - 1);
+        if (cache->keys[slot] == 0) {
+            *insertSlot = slot;
+            return -1;
         }
+        if (cache->keys[slot] == key &&
+                memcmp(cache->lattice + slot * numofDOFs, cache->queryLattice, numofDOFs * sizeof(unsigned short)) == 0)
+            return slot;
+        if (oldestSlot == -1 || cache->stamps[slot] < cache->stamps[oldestSlot])
+            oldestSlot = slot;
     }
-    return sqrt(closestNeighborDistance);
+    if (CONFIG_CACHE_EVICTION != CACHE_EVICT_NONE) {
+        *insertSlot = oldestSlot;
+        worldMap->stats.configCacheEvictions++;
+    }
+    return -1;
 }
 
-// Given currJoint and joints (all the existing joints),
-// sets closestNeighbor to the joint within joints that's closest to currJoint
-// and also returns the distance between closestNeighbor and currJoint
-double getClosestNeighborFromTreeAndNearNodes(double* currJoint, vector<Node*>* tree, int numofDOFs, Node** closestNeighbor,
-        vector<Node*>* nearNodes, vector<double>* nearNodeDistances, double radius) {
+// IsValidArmConfiguration through the configuration cache (see CONFIG_CACHE_SIZE).
+// Misses check the closest lattice configuration and remember the result.
+template <int DOF>
+static int IsValidArmConfigurationCached(double* angles, int dynamicDOFs, WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    if (CONFIG_CACHE_SIZE == 0)
+        return IsValidArmConfigurationDOF<DOF>(angles, numofDOFs, worldMap);
 
-    radius = pow(radius, 2);
-    double closestNeighborDistance = (pow(2 * PI, 2) * numofDOFs);
+    ConfigCache* cache = worldMap->configCache;
+    if (cache == 0 || cache->numofDOFs != numofDOFs) {
+        if (cache != 0)
+            freeConfigCache(cache);
+        cache = createConfigCache(numofDOFs, getAngleDiscretizationFactor(numofDOFs), CONFIG_CACHE_SIZE);
+        worldMap->configCache = cache;
+    }
 
-    for (int i = 0; i < tree->size(); i++) {
-        Node* neighbor = (*tree)[i];
-        double* neighborJoint = neighbor->joint;
-        double currNeighborDistance = 0;
-        for (int j = 0; j < numofDOFs; j++) {
-            currNeighborDistance += pow(fabs(neighborJoint[j] - currJoint[j]), 2);
-        }
-        //printf("***neighborJoint is , [%f, %f, %f, %f, %f]\n",
-        //            neighborJoint[0], neighborJoint[1], neighborJoint[2], neighborJoint[3], neighborJoint[4]);
-        if(currNeighborDistance < closestNeighborDistance) {
-            *closestNeighbor = neighbor;
-            closestNeighborDistance = currNeighborDistance;
-        }
-        if (currNeighborDistance <= radius) {
-            nearNodes->push_back(neighbor);
-            nearNodeDistances->push_back(sqrt(currNeighborDistance));
-        }
+    int discretizationFactor = cache->discretizationFactor;
+    uint64_t key = 14695981039346656037ULL;
+    for (int j = 0; j < numofDOFs; j++) {
+        int index = ((int) floor(angles[j] * discretizationFactor / (2 * PI) + 0.5)) % discretizationFactor;
+        if (index < 0)
+            index += discretizationFactor;
+        cache->queryLattice[j] = index;
+        key = (key ^ index) * 1099511628211ULL;
     }
-    return sqrt(closestNeighborDistance);
+    if (key == 0)
+        key = 1;
+
+    int insertSlot;
+    int slot = findConfigCacheSlot(cache, key, &insertSlot, worldMap);
+    cache->clock++;
+    if (slot >= 0) {
+        worldMap->stats.configCacheHits++;
+        if (CONFIG_CACHE_EVICTION == CACHE_EVICT_LRU)
+            cache->stamps[slot] = cache->clock;
+        return cache->valid[slot];
+    }
+
+    worldMap->stats.configCacheMisses++;
+    for (int j = 0; j < numofDOFs; j++) {
+        cache->queryJoint[j] = (2 * PI) * (((double) cache->queryLattice[j])/discretizationFactor);
+    }
+    int valid = IsValidArmConfigurationDOF<DOF>(cache->queryJoint, numofDOFs, worldMap);
+    if (insertSlot >= 0) {
+        cache->keys[insertSlot] = key;
+        memcpy(cache->lattice + insertSlot * numofDOFs, cache->queryLattice, numofDOFs * sizeof(unsigned short));
+        cache->stamps[insertSlot] = cache->clock;
+        cache->valid[insertSlot] = valid;
+    }
+    return valid;
 }
 
-static int isJointTransitionValid(double distance, double discretizationStep, int numofDOFs, double* currJoint, double* closestNeighbor,
-        double* worldMap, int x_size, int y_size) {
-    double* tempJoint = (double*) malloc(numofDOFs * sizeof(double));
-    int numSteps = ((int) (distance/discretizationStep));
-    for (int i = 1; i <= numSteps; i++) {
-        for (int j = 0; j < numofDOFs; j++) {
-            tempJoint[j] = closestNeighbor[j] + (i * discretizationStep) * ((currJoint[j] - closestNeighbor[j])/distance);
-        }
-        if (!IsValidArmConfiguration(tempJoint, numofDOFs, worldMap, x_size, y_size)) {
-            return 0;
+// Incremental KD-tree over joint configurations.  Points are identified by the
+// order they were added in (their id) and are split on one joint per level,
+// cycling through the joints.  With wrap set, every joint is an angle in
+// [0, 2*PI) and distances are measured around the torus instead.
+typedef struct {
+    int numofDOFs;
+    int wrap;
+    int size, capacity;
+    double** points;
+    int* left;
+    int* right;
+    int* splitDim;
+    int root;
+} KDTree;
+
+KDTree* createKDTree(int numofDOFs, int wrap) {
+    KDTree* tree = (KDTree*) malloc(sizeof(KDTree));
+    tree->numofDOFs = numofDOFs;
+    tree->wrap = wrap;
+    tree->size = 0;
+    tree->capacity = 64;
+    tree->points = (double**) malloc(tree->capacity * sizeof(double*));
+    tree->left = (int*) malloc(tree->capacity * sizeof(int));
+    tree->right = (int*) malloc(tree->capacity * sizeof(int));
+    tree->splitDim = (int*) malloc(tree->capacity * sizeof(int));
+    tree->root = -1;
+    return tree;
+}
+
+void freeKDTree(KDTree* tree) {
+    free(tree->points);
+    free(tree->left);
+    free(tree->right);
+    free(tree->splitDim);
+    free(tree);
+}
+
+// Forgets every point, keeping the allocated storage
+static void kdTreeClear(KDTree* tree) {
+    tree->size = 0;
+    tree->root = -1;
+}
+
+// Adds point (which the tree references, not copies) and returns its id
+static int kdTreeAdd(KDTree* tree, double* point) {
+    if (tree->size == tree->capacity) {
+        tree->capacity *= 2;
+        tree->points = (double**) realloc(tree->points, tree->capacity * sizeof(double*));
+        tree->left = (int*) realloc(tree->left, tree->capacity * sizeof(int));
+        tree->right = (int*) realloc(tree->right, tree->capacity * sizeof(int));
+        tree->splitDim = (int*) realloc(tree->splitDim, tree->capacity * sizeof(int));
+    }
+    int id = tree->size++;
+    tree->points[id] = point;
+    tree->left[id] = -1;
+    tree->right[id] = -1;
+    if (tree->root == -1) {
+        tree->root = id;
+        tree->splitDim[id] = 0;
+        return id;
+    }
+    int node = tree->root;
+    while (1) {
+        int dim = tree->splitDim[node];
+        int* child = (point[dim] < tree->points[node][dim]) ? &tree->left[node] : &tree->right[node];
+        if (*child == -1) {
+            *child = id;
+            tree->splitDim[id] = (dim + 1) % tree->numofDOFs;
+            return id;
         }
+        node = *child;
     }
-    return 1;
 }
 
-static void generateRandomJoint(double** joint, int numofDOFs) {
-    for (int i = 0; i < numofDOFs; i++) {
-        (*joint)[i] = (rand() / (RAND_MAX/(2 * PI )));
-    }
+static inline double kdTreeAxisDistance(KDTree* tree, double a, double b) {
+    double d = fabs(a - b);
+    if (tree->wrap && d > PI)
+        d = 2 * PI - d;
+    return d;
 }
 
-static double getPlanQuality(double*** plan, int* planlength, int numofDOFs) {
+static double kdTreeDistanceSquared(KDTree* tree, double* point, double* query) {
     double distance = 0;
-    for (int i = 0; i < *planlength - 1; i++) {
-        double* currPlan = (*plan)[i];
-        double* nextPlan = (*plan)[i+1];
-        double currDistance = 0;
-        for (int j = 0; j < numofDOFs; j++) {
-            currDistance += pow(fabs(currPlan[j] - nextPlan[j]), 2);
-        }
-        distance += sqrt(currDistance);
+    for (int j = 0; j < tree->numofDOFs; j++) {
+        double d = kdTreeAxisDistance(tree, point[j], query[j]);
+        distance += d * d;
     }
     return distance;
 }
 
-static ExperimentResult plannerRRT(double* worldMap, int x_size, int y_size,
-        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int numofDOFs,
+// Lower bound on the distance from query to any point on the far side of the
+// split value at node (the side query does not fall on)
+static double kdTreeFarSideBound(KDTree* tree, double q, double split) {
+    if (!tree->wrap)
+        return fabs(q - split);
+    // going around the torus, the far side can also be reached through 0 / 2*PI
+    if (q < split)
+        return MIN(split - q, q);
+    return MIN(q - split, 2 * PI - q);
+}
+
+static void kdTreeSearchNearest(KDTree* tree, int node, double* query, int* best, double* bestDistance) {
+    while (node != -1) {
+        double distance = kdTreeDistanceSquared(tree, tree->points[node], query);
+        if (distance < *bestDistance || (distance == *bestDistance && node < *best)) {
+            *best = node;
+            *bestDistance = distance;
+        }
+        int dim = tree->splitDim[node];
+        double split = tree->points[node][dim];
+        int nearChild = (query[dim] < split) ? tree->left[node] : tree->right[node];
+        int farChild = (query[dim] < split) ? tree->right[node] : tree->left[node];
+        double bound = kdTreeFarSideBound(tree, query[dim], split);
+        if (farChild != -1 && bound * bound <= *bestDistance)
+            kdTreeSearchNearest(tree, farChild, query, best, bestDistance);
+        node = nearChild;
+    }
+}
+
+// Returns the id of the point closest to query (the lowest id among equally
+// close ones) and sets *distance to how far it is, or returns -1 if the tree is empty
+static int kdTreeNearest(KDTree* tree, double* query, double* distance) {
+    int best = -1;
+    double bestDistance = DT_INFINITY;
+    kdTreeSearchNearest(tree, tree->root, query, &best, &bestDistance);
+    *distance = sqrt(bestDistance);
+    return best;
+}
+
+static void kdTreeSearchKNearest(KDTree* tree, int node, double* query, int k,
+        priority_queue<pair<double, int> >* nearest) {
+    while (node != -1) {
+        double distance = kdTreeDistanceSquared(tree, tree->points[node], query);
+        if (nearest->size() < k) {
+            nearest->push(make_pair(distance, node));
+        } else if (make_pair(distance, node) < nearest->top()) {
+            nearest->pop();
+            nearest->push(make_pair(distance, node));
+        }
+        int dim = tree->splitDim[node];
+        double split = tree->points[node][dim];
+        int nearChild = (query[dim] < split) ? tree->left[node] : tree->right[node];
+        int farChild = (query[dim] < split) ? tree->right[node] : tree->left[node];
+        double bound = kdTreeFarSideBound(tree, query[dim], split);
+        if (farChild != -1 && (nearest->size() < k || bound * bound <= nearest->top().first))
+            kdTreeSearchKNearest(tree, farChild, query, k, nearest);
+        node = nearChild;
+    }
+}
+
+// Appends the ids of the (at most) k points closest to query to ids, closest
+// first (lowest id first among equally close ones), and their distances to distances
+static void kdTreeKNearest(KDTree* tree, double* query, int k, vector<int>* ids, vector<double>* distances) {
+    priority_queue<pair<double, int> > nearest;
+    if (k > 0)
+        kdTreeSearchKNearest(tree, tree->root, query, k, &nearest);
+    int first = ids->size();
+    ids->resize(first + nearest.size());
+    distances->resize(first + nearest.size());
+    for (int i = ids->size() - 1; i >= first; i--) {
+        (*ids)[i] = nearest.top().second;
+        (*distances)[i] = sqrt(nearest.top().first);
+        nearest.pop();
+    }
+}
+
+static void kdTreeSearchRadius(KDTree* tree, int node, double* query, double radiusSquared, vector<int>* ids) {
+    while (node != -1) {
+        if (kdTreeDistanceSquared(tree, tree->points[node], query) <= radiusSquared)
+            ids->push_back(node);
+        int dim = tree->splitDim[node];
+        double split = tree->points[node][dim];
+        int nearChild = (query[dim] < split) ? tree->left[node] : tree->right[node];
+        int farChild = (query[dim] < split) ? tree->right[node] : tree->left[node];
+        double bound = kdTreeFarSideBound(tree, query[dim], split);
+        if (farChild != -1 && bound * bound <= radiusSquared)
+            kdTreeSearchRadius(tree, farChild, query, radiusSquared, ids);
+        node = nearChild;
+    }
+}
+
+// Appends the ids of all points within radius of query to ids, in increasing
+// id order, and their distances to distances
+static void kdTreeRadius(KDTree* tree, double* query, double radius, vector<int>* ids, vector<double>* distances) {
+    int first = ids->size();
+    kdTreeSearchRadius(tree, tree->root, query, radius * radius, ids);
+    sort(ids->begin() + first, ids->end());
+    for (int i = first; i < ids->size(); i++) {
+        distances->push_back(sqrt(kdTreeDistanceSquared(tree, tree->points[(*ids)[i]], query)));
+    }
+}
+
+typedef double (*JointMetric)(double* joint, double* otherJoint, int numofDOFs);
+
+// Euclidean distance in joint space, the metric the planners steer with
+template <int DOF>
+static double euclideanJointDistance(double* joint, double* otherJoint, int numofDOFs) {
+    double distance = 0;
+    for (int j = 0; j < FIXED_DOFS(DOF, numofDOFs); j++) {
+        double d = joint[j] - otherJoint[j];
+        distance += d * d;
+    }
+    return sqrt(distance);
+}
+
+// The instantiation of euclideanJointDistance for numofDOFs joints
+static JointMetric getEuclideanJointMetric(int numofDOFs) {
+    switch (numofDOFs) {
+        case 2: return euclideanJointDistance<2>;
+        case 3: return euclideanJointDistance<3>;
+        case 4: return euclideanJointDistance<4>;
+        case 5: return euclideanJointDistance<5>;
+        case 6: return euclideanJointDistance<6>;
+        case 7: return euclideanJointDistance<7>;
+        case 8: return euclideanJointDistance<8>;
+        case 9: return euclideanJointDistance<9>;
+        case 10: return euclideanJointDistance<10>;
+        default: return euclideanJointDistance<0>;
+    }
+}
+
+// Vantage point tree over joint configurations under any metric.  The subtree
+// laid out on order[lo, hi) has vantage point order[lo]; the points of
+// order[lo+1, split[lo]) lie within radius[lo] of it and those of
+// order[split[lo], hi) no closer than that.  Points added since the last build
+// (ids builtSize and up) wait in a buffer that queries scan.
+typedef struct {
+    int numofDOFs;
+    JointMetric metric;
+    int size, capacity;
+    double** points;
+    int builtSize;
+    int* order;
+    int* split;
+    double* radius;
+} VPTree;
+
+VPTree* createVPTree(int numofDOFs, JointMetric metric) {
+    VPTree* tree = (VPTree*) malloc(sizeof(VPTree));
+    tree->numofDOFs = numofDOFs;
+    tree->metric = metric;
+    tree->size = 0;
+    tree->builtSize = 0;
+    tree->capacity = 64;
+    tree->points = (double**) malloc(tree->capacity * sizeof(double*));
+    tree->order = (int*) malloc(tree->capacity * sizeof(int));
+    tree->split = (int*) malloc(tree->capacity * sizeof(int));
+    tree->radius = (double*) malloc(tree->capacity * sizeof(double));
+    return tree;
+}
+
+void freeVPTree(VPTree* tree) {
+    free(tree->points);
+    free(tree->order);
+    free(tree->split);
+    free(tree->radius);
+    free(tree);
+}
+
+static void vpTreeClear(VPTree* tree) {
+    tree->size = 0;
+    tree->builtSize = 0;
+}
+
+// Lays out the subtree of order[lo, hi), splitting at the median distance
+// from the vantage point
+static void vpTreeBuild(VPTree* tree, int lo, int hi, vector<pair<double, int> >* scratch) {
+    if (hi - lo <= 1)
+        return;
+    double* vantage = tree->points[tree->order[lo]];
+    scratch->clear();
+    for (int i = lo + 1; i < hi; i++) {
+        scratch->push_back(make_pair(tree->metric(vantage, tree->points[tree->order[i]], tree->numofDOFs), tree->order[i]));
+    }
+    int median = scratch->size() / 2;
+    nth_element(scratch->begin(), scratch->begin() + median, scratch->end());
+    for (int i = 0; i < scratch->size(); i++) {
+        tree->order[lo + 1 + i] = (*scratch)[i].second;
+    }
+    tree->split[lo] = lo + 1 + median;
+    tree->radius[lo] = (*scratch)[median].first;
+    vpTreeBuild(tree, lo + 1, lo + 1 + median, scratch);
+    vpTreeBuild(tree, lo + 1 + median, hi, scratch);
+}
+
+// Adds point (which the tree references, not copies) and returns its id
+static int vpTreeAdd(VPTree* tree, double* point) {
+    if (tree->size == tree->capacity) {
+        tree->capacity *= 2;
+        tree->points = (double**) realloc(tree->points, tree->capacity * sizeof(double*));
+        tree->order = (int*) realloc(tree->order, tree->capacity * sizeof(int));
+        tree->split = (int*) realloc(tree->split, tree->capacity * sizeof(int));
+        tree->radius = (double*) realloc(tree->radius, tree->capacity * sizeof(double));
+    }
+    int id = tree->size++;
+    tree->points[id] = point;
+    int buffered = tree->size - tree->builtSize;
+    if (buffered > VP_TREE_MIN_BUFFER && buffered > tree->builtSize / VP_TREE_BUFFER_DIVISOR) {
+        for (int i = 0; i < tree->size; i++) {
+            tree->order[i] = i;
+        }
+        vector<pair<double, int> > scratch;
+        vpTreeBuild(tree, 0, tree->size, &scratch);
+        tree->builtSize = tree->size;
+    }
+    return id;
+}
+
+static void vpTreeSearchNearest(VPTree* tree, int lo, int hi, double* query, int* best, double* bestDistance) {
+    if (lo >= hi)
+        return;
+    int vantage = tree->order[lo];
+    double distance = tree->metric(query, tree->points[vantage], tree->numofDOFs);
+    if (distance < *bestDistance || (distance == *bestDistance && vantage < *best)) {
+        *best = vantage;
+        *bestDistance = distance;
+    }
+    if (hi - lo == 1)
+        return;
+    // visit the side query falls on first, the other one only if the
+    // triangle inequality allows a point there to be closer
+    int mid = tree->split[lo];
+    double radius = tree->radius[lo];
+    if (distance < radius) {
+        vpTreeSearchNearest(tree, lo + 1, mid, query, best, bestDistance);
+        if (radius - distance <= *bestDistance)
+            vpTreeSearchNearest(tree, mid, hi, query, best, bestDistance);
+    } else {
+        vpTreeSearchNearest(tree, mid, hi, query, best, bestDistance);
+        if (distance - radius <= *bestDistance)
+            vpTreeSearchNearest(tree, lo + 1, mid, query, best, bestDistance);
+    }
+}
+
+// Returns the id of the point closest to query (the lowest id among equally
+// close ones) and sets *distance to how far it is, or returns -1 if the tree is empty
+static int vpTreeNearest(VPTree* tree, double* query, double* distance) {
+    int best = -1;
+    *distance = DT_INFINITY;
+    vpTreeSearchNearest(tree, 0, tree->builtSize, query, &best, distance);
+    for (int i = tree->builtSize; i < tree->size; i++) {
+        double d = tree->metric(query, tree->points[i], tree->numofDOFs);
+        if (d < *distance) {
+            best = i;
+            *distance = d;
+        }
+    }
+    return best;
+}
+
+static void vpTreeSearchKNearest(VPTree* tree, int lo, int hi, double* query, int k,
+        priority_queue<pair<double, int> >* nearest) {
+    if (lo >= hi)
+        return;
+    int vantage = tree->order[lo];
+    double distance = tree->metric(query, tree->points[vantage], tree->numofDOFs);
+    if (nearest->size() < k) {
+        nearest->push(make_pair(distance, vantage));
+    } else if (make_pair(distance, vantage) < nearest->top()) {
+        nearest->pop();
+        nearest->push(make_pair(distance, vantage));
+    }
+    if (hi - lo == 1)
+        return;
+    int mid = tree->split[lo];
+    double radius = tree->radius[lo];
+    int nearLo = (distance < radius) ? lo + 1 : mid;
+    int nearHi = (distance < radius) ? mid : hi;
+    int farLo = (distance < radius) ? mid : lo + 1;
+    int farHi = (distance < radius) ? hi : mid;
+    vpTreeSearchKNearest(tree, nearLo, nearHi, query, k, nearest);
+    if (nearest->size() < k || fabs(distance - radius) <= nearest->top().first)
+        vpTreeSearchKNearest(tree, farLo, farHi, query, k, nearest);
+}
+
+// Appends the ids of the (at most) k points closest to query to ids, closest
+// first (lowest id first among equally close ones), and their distances to distances
+static void vpTreeKNearest(VPTree* tree, double* query, int k, vector<int>* ids, vector<double>* distances) {
+    priority_queue<pair<double, int> > nearest;
+    if (k <= 0)
+        return;
+    vpTreeSearchKNearest(tree, 0, tree->builtSize, query, k, &nearest);
+    for (int i = tree->builtSize; i < tree->size; i++) {
+        double distance = tree->metric(query, tree->points[i], tree->numofDOFs);
+        if (nearest.size() < k) {
+            nearest.push(make_pair(distance, i));
+        } else if (make_pair(distance, i) < nearest.top()) {
+            nearest.pop();
+            nearest.push(make_pair(distance, i));
+        }
+    }
+    int first = ids->size();
+    ids->resize(first + nearest.size());
+    distances->resize(first + nearest.size());
+    for (int i = ids->size() - 1; i >= first; i--) {
+        (*ids)[i] = nearest.top().second;
+        (*distances)[i] = nearest.top().first;
+        nearest.pop();
+    }
+}
+
+static void vpTreeSearchRadius(VPTree* tree, int lo, int hi, double* query, double radius,
+        vector<pair<int, double> >* found) {
+    if (lo >= hi)
+        return;
+    int vantage = tree->order[lo];
+    double distance = tree->metric(query, tree->points[vantage], tree->numofDOFs);
+    if (distance <= radius)
+        found->push_back(make_pair(vantage, distance));
+    if (hi - lo == 1)
+        return;
+    int mid = tree->split[lo];
+    if (distance - tree->radius[lo] <= radius)
+        vpTreeSearchRadius(tree, lo + 1, mid, query, radius, found);
+    if (tree->radius[lo] - distance <= radius)
+        vpTreeSearchRadius(tree, mid, hi, query, radius, found);
+}
+
+// Appends the ids of all points within radius of query to ids, in increasing
+// id order, and their distances to distances
+static void vpTreeRadius(VPTree* tree, double* query, double radius, vector<int>* ids, vector<double>* distances) {
+    vector<pair<int, double> > found;
+    vpTreeSearchRadius(tree, 0, tree->builtSize, query, radius, &found);
+    sort(found.begin(), found.end());
+    for (int i = 0; i < found.size(); i++) {
+        ids->push_back(found[i].first);
+        distances->push_back(found[i].second);
+    }
+    for (int i = tree->builtSize; i < tree->size; i++) {
+        double distance = tree->metric(query, tree->points[i], tree->numofDOFs);
+        if (distance <= radius) {
+            ids->push_back(i);
+            distances->push_back(distance);
+        }
+    }
+}
+
+// Spatial hash of joint configurations on a grid with cells of cellSize radians
+// per joint.  Occupied cells live in an open addressing table (a key of 0
+// marks an empty slot); the ids in a cell are chained through next, starting
+// at the cell's head.
+typedef struct {
+    int numofDOFs;
+    double cellSize;
+    int tableSize, numCells;
+    uint64_t* keys;
+    int* heads;
+    int capacity;
+    int* next;
+    int* cell;   // scratch cell coordinates
+    int* offset; // scratch probe offsets
+} GridHash;
+
+GridHash* createGridHash(int numofDOFs, double cellSize) {
+    GridHash* grid = (GridHash*) malloc(sizeof(GridHash));
+    grid->numofDOFs = numofDOFs;
+    grid->cellSize = cellSize;
+    grid->tableSize = 256;
+    grid->numCells = 0;
+    grid->keys = (uint64_t*) calloc(grid->tableSize, sizeof(uint64_t));
+    grid->heads = (int*) malloc(grid->tableSize * sizeof(int));
+    grid->capacity = 64;
+    grid->next = (int*) malloc(grid->capacity * sizeof(int));
+    grid->cell = (int*) malloc(numofDOFs * sizeof(int));
+    grid->offset = (int*) malloc(numofDOFs * sizeof(int));
+    return grid;
+}
+
+void freeGridHash(GridHash* grid) {
+    free(grid->keys);
+    free(grid->heads);
+    free(grid->next);
+    free(grid->cell);
+    free(grid->offset);
+    free(grid);
+}
+
+static void gridHashClear(GridHash* grid) {
+    memset(grid->keys, 0, grid->tableSize * sizeof(uint64_t));
+    grid->numCells = 0;
+}
+
+static uint64_t gridHashCellKey(GridHash* grid, int* cell) {
+    uint64_t key = 14695981039346656037ULL;
+    for (int j = 0; j < grid->numofDOFs; j++) {
+        key = (key ^ (uint32_t) cell[j]) * 1099511628211ULL;
+    }
+    return (key ^ (key >> 31)) | 1;
+}
+
+// Returns the slot of the cell with key, or of the empty slot it would take
+static int gridHashFindSlot(GridHash* grid, uint64_t key) {
+    int slot = key & (grid->tableSize - 1);
+    while (grid->keys[slot] != 0 && grid->keys[slot] != key) {
+        slot = (slot + 1) & (grid->tableSize - 1);
+    }
+    return slot;
+}
+
+// Adds the point with the given id (ids have to be added in order)
+static void gridHashAdd(GridHash* grid, int id, double* point) {
+    if (id >= grid->capacity) {
+        grid->capacity *= 2;
+        grid->next = (int*) realloc(grid->next, grid->capacity * sizeof(int));
+    }
+    if (2 * (grid->numCells + 1) > grid->tableSize) {
+        uint64_t* oldKeys = grid->keys;
+        int* oldHeads = grid->heads;
+        int oldSize = grid->tableSize;
+        grid->tableSize *= 2;
+        grid->keys = (uint64_t*) calloc(grid->tableSize, sizeof(uint64_t));
+        grid->heads = (int*) malloc(grid->tableSize * sizeof(int));
+        for (int i = 0; i < oldSize; i++) {
+            if (oldKeys[i] == 0)
+                continue;
+            int slot = gridHashFindSlot(grid, oldKeys[i]);
+            grid->keys[slot] = oldKeys[i];
+            grid->heads[slot] = oldHeads[i];
+        }
+        free(oldKeys);
+        free(oldHeads);
+    }
+    for (int j = 0; j < grid->numofDOFs; j++) {
+        grid->cell[j] = (int) floor(point[j] / grid->cellSize);
+    }
+    uint64_t key = gridHashCellKey(grid, grid->cell);
+    int slot = gridHashFindSlot(grid, key);
+    if (grid->keys[slot] == 0) {
+        grid->keys[slot] = key;
+        grid->heads[slot] = -1;
+        grid->numCells++;
+    }
+    grid->next[id] = grid->heads[slot];
+    grid->heads[slot] = id;
+}
+
+// The nearest neighbour index a planner keeps next to its vector of nodes: the
+// id of a node in the index is its position in that vector.  The joints are
+// copied joint by joint (coords[j][id] is joint j of node id) so that small
+// indexes can be scanned in one pass over contiguous memory.  The planners
+// interpolate and measure edges in plain joint space, so they don't wrap angles.
+typedef struct {
+    int numofDOFs;
+    int size, capacity;
+    double** coords;
+    double* distances; // squared distances of the last scan
+    KDTree* kdTree;
+    VPTree* vpTree;
+    GridHash* grid;
+    long numQueries;
+    double queryTime; // seconds spent in queries
+    long numApproximateQueries; // queries answered from the grid cells rather than exactly
+    long recallSamples, recallHits; // approximate queries checked, and found exact
+} NNIndex;
+
+NNIndex* createNNIndex(int numofDOFs) {
+    NNIndex* index = (NNIndex*) malloc(sizeof(NNIndex));
+    index->numofDOFs = numofDOFs;
+    index->size = 0;
+    index->capacity = 64;
+    index->coords = (double**) malloc(numofDOFs * sizeof(double*));
+    for (int j = 0; j < numofDOFs; j++) {
+        index->coords[j] = (double*) malloc(index->capacity * sizeof(double));
+    }
+    index->distances = (double*) malloc(index->capacity * sizeof(double));
+    index->kdTree = createKDTree(numofDOFs, 0);
+    index->vpTree = createVPTree(numofDOFs, getEuclideanJointMetric(numofDOFs));
+    index->grid = createGridHash(numofDOFs, NN_APPROX_CELL_STEPS * (2 * PI) / getAngleDiscretizationFactor(numofDOFs));
+    index->numQueries = 0;
+    index->queryTime = 0;
+    index->numApproximateQueries = 0;
+    index->recallSamples = 0;
+    index->recallHits = 0;
+    return index;
+}
+
+void freeNNIndex(NNIndex* index) {
+    for (int j = 0; j < index->numofDOFs; j++) {
+        free(index->coords[j]);
+    }
+    free(index->coords);
+    free(index->distances);
+    freeKDTree(index->kdTree);
+    freeVPTree(index->vpTree);
+    freeGridHash(index->grid);
+    free(index);
+}
+
+// Adds joint as the next node of the index
+static void nnIndexAdd(NNIndex* index, double* joint) {
+    if (index->size == index->capacity) {
+        index->capacity *= 2;
+        for (int j = 0; j < index->numofDOFs; j++) {
+            index->coords[j] = (double*) realloc(index->coords[j], index->capacity * sizeof(double));
+        }
+        index->distances = (double*) realloc(index->distances, index->capacity * sizeof(double));
+    }
+    for (int j = 0; j < index->numofDOFs; j++) {
+        index->coords[j][index->size] = joint[j];
+    }
+    index->size++;
+    if (NN_BACKEND == NN_KDTREE)
+        kdTreeAdd(index->kdTree, joint);
+    if (NN_BACKEND == NN_VPTREE)
+        vpTreeAdd(index->vpTree, joint);
+    if (NN_APPROXIMATE)
+        gridHashAdd(index->grid, index->size - 1, joint);
+}
+
+// Re-adds every node of tree after nodes were removed from it, so that ids
+// match positions in tree again
+static void nnIndexRebuild(NNIndex* index, vector<Node*>* tree) {
+    if (index->size == tree->size())
+        return;
+    index->size = 0;
+    kdTreeClear(index->kdTree);
+    vpTreeClear(index->vpTree);
+    gridHashClear(index->grid);
+    for (int i = 0; i < tree->size(); i++) {
+        nnIndexAdd(index, (*tree)[i]->joint);
+    }
+}
+
+// Whether queries should scan the index rather than search the KD-tree
+static inline int nnIndexScans(NNIndex* index) {
+    return NN_BACKEND == NN_SCAN || index->size < NN_SCAN_MAX_SIZE;
+}
+
+// Fills index->distances with the squared distance from query to every node,
+// summing over the joints in order just like the KD-tree does
+template <int DOF>
+static void nnIndexScanDistancesDOF(NNIndex* index, double* query) {
+    int numofDOFs = FIXED_DOFS(DOF, index->numofDOFs);
+    int size = index->size;
+    double* distances = index->distances;
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= size; i += 4) {
+        __m256d sum = _mm256_setzero_pd();
+        for (int j = 0; j < numofDOFs; j++) {
+            __m256d d = _mm256_sub_pd(_mm256_loadu_pd(index->coords[j] + i), _mm256_set1_pd(query[j]));
+            sum = _mm256_add_pd(sum, _mm256_mul_pd(d, d));
+        }
+        _mm256_storeu_pd(distances + i, sum);
+    }
+#endif
+    for (int k = i; k < size; k++) {
+        distances[k] = 0;
+    }
+    for (int j = 0; j < numofDOFs; j++) {
+        double* coord = index->coords[j];
+        double q = query[j];
+        for (int k = i; k < size; k++) {
+            double d = coord[k] - q;
+            distances[k] += d * d;
+        }
+    }
+}
+
+static void nnIndexScanDistances(NNIndex* index, double* query) {
+    DISPATCH_ON_DOF(index->numofDOFs, nnIndexScanDistancesDOF, (index, query))
+}
+
+// Returns the id of the node closest to query (the lowest id among equally
+// close ones) and sets *distance to how far it is
+static int nnIndexNearest(NNIndex* index, double* query, double* distance) {
+    if (!nnIndexScans(index) && NN_BACKEND == NN_VPTREE)
+        return vpTreeNearest(index->vpTree, query, distance);
+    if (!nnIndexScans(index))
+        return kdTreeNearest(index->kdTree, query, distance);
+    nnIndexScanDistances(index, query);
+    int best = 0;
+    for (int i = 1; i < index->size; i++) {
+        if (index->distances[i] < index->distances[best])
+            best = i;
+    }
+    *distance = sqrt(index->distances[best]);
+    return best;
+}
+
+// Like nnIndexNearest, but only looks at the nodes in the grid cells within
+// NN_APPROX_PROBE_RADIUS cells of query's cell, falling back to an exact query
+// when those are all empty
+static int nnIndexApproximateNearest(NNIndex* index, double* query, double* distance) {
+    // small indexes are scanned faster than their cells are probed
+    if (nnIndexScans(index))
+        return nnIndexNearest(index, query, distance);
+    GridHash* grid = index->grid;
+    int numofDOFs = index->numofDOFs;
+    int best = -1;
+    double bestDistance = DT_INFINITY;
+    for (int j = 0; j < numofDOFs; j++) {
+        grid->offset[j] = -NN_APPROX_PROBE_RADIUS;
+    }
+    while (1) {
+        for (int j = 0; j < numofDOFs; j++) {
+            grid->cell[j] = (int) floor(query[j] / grid->cellSize) + grid->offset[j];
+        }
+        int slot = gridHashFindSlot(grid, gridHashCellKey(grid, grid->cell));
+        if (grid->keys[slot] != 0) {
+            for (int id = grid->heads[slot]; id != -1; id = grid->next[id]) {
+                double d = 0;
+                for (int j = 0; j < numofDOFs; j++) {
+                    double diff = index->coords[j][id] - query[j];
+                    d += diff * diff;
+                }
+                if (d < bestDistance || (d == bestDistance && id < best)) {
+                    best = id;
+                    bestDistance = d;
+                }
+            }
+        }
+        // step the probe offsets like an odometer
+        int j = 0;
+        while (j < numofDOFs && grid->offset[j] == NN_APPROX_PROBE_RADIUS) {
+            grid->offset[j] = -NN_APPROX_PROBE_RADIUS;
+            j++;
+        }
+        if (j == numofDOFs)
+            break;
+        grid->offset[j]++;
+    }
+    if (best == -1)
+        return nnIndexNearest(index, query, distance);
+    index->numApproximateQueries++;
+    *distance = sqrt(bestDistance);
+    return best;
+}
+
+// Appends the ids of all nodes within radius of query to ids, in increasing id
+// order, and their distances to distances
+static void nnIndexRadius(NNIndex* index, double* query, double radius, vector<int>* ids, vector<double>* distances) {
+    if (!nnIndexScans(index) && NN_BACKEND == NN_VPTREE) {
+        vpTreeRadius(index->vpTree, query, radius, ids, distances);
+        return;
+    }
+    if (!nnIndexScans(index)) {
+        kdTreeRadius(index->kdTree, query, radius, ids, distances);
+        return;
+    }
+    nnIndexScanDistances(index, query);
+    double radiusSquared = radius * radius;
+    for (int i = 0; i < index->size; i++) {
+        if (index->distances[i] <= radiusSquared) {
+            ids->push_back(i);
+            distances->push_back(sqrt(index->distances[i]));
+        }
+    }
+}
+
+// Appends the ids of the (at most) k nodes closest to query to ids, closest
+// first (lowest id first among equally close ones), and their distances to distances
+static void nnIndexKNearest(NNIndex* index, double* query, int k, vector<int>* ids, vector<double>* distances) {
+    if (k <= 0 || index->size == 0)
+        return;
+    if (!nnIndexScans(index) && NN_BACKEND == NN_VPTREE) {
+        vpTreeKNearest(index->vpTree, query, k, ids, distances);
+        return;
+    }
+    if (!nnIndexScans(index)) {
+        kdTreeKNearest(index->kdTree, query, k, ids, distances);
+        return;
+    }
+    nnIndexScanDistances(index, query);
+    vector<pair<double, int> > nearest;
+    for (int i = 0; i < index->size; i++) {
+        nearest.push_back(make_pair(index->distances[i], i));
+    }
+    k = MIN(k, (int) nearest.size());
+    partial_sort(nearest.begin(), nearest.begin() + k, nearest.end());
+    for (int i = 0; i < k; i++) {
+        ids->push_back(nearest[i].second);
+        distances->push_back(sqrt(nearest[i].first));
+    }
+}
+
+// Counts a query on index that started at queryStart
+static void recordNNQuery(NNIndex* index, clock_t queryStart) {
+    index->numQueries++;
+    index->queryTime += (clock() - queryStart) / (double) CLOCKS_PER_SEC;
+}
+
+// Copies the nearest neighbour counters of index (plus those of otherIndex, if
+// the planner grows two trees) into result
+static void recordNNStats(ExperimentResult* result, NNIndex* index, NNIndex* otherIndex) {
+    result->nnIndexSize = index->size;
+    result->numNNQueries = index->numQueries;
+    result->nnQueryTime = index->queryTime;
+    long recallSamples = index->recallSamples;
+    long recallHits = index->recallHits;
+    if (otherIndex != 0) {
+        result->nnIndexSize += otherIndex->size;
+        result->numNNQueries += otherIndex->numQueries;
+        result->nnQueryTime += otherIndex->queryTime;
+        recallSamples += otherIndex->recallSamples;
+        recallHits += otherIndex->recallHits;
+    }
+    result->nnRecall = (recallSamples > 0) ? ((double) recallHits) / recallSamples : 1;
+}
+
+// Given currJoint and joints (all the existing joints),
+// sets closestNeighbor to the joint within joints that's closest to currJoint
+// and also returns the distance between closestNeighbor and currJoint
+double getClosestNeighborFromTree(double* currJoint, vector<Node*>* tree, NNIndex* index, int numofDOFs, Node** closestNeighbor) {
+
+    clock_t queryStart = clock();
+    if (NN_BACKEND != NN_LINEAR && NN_APPROXIMATE) {
+        double distance;
+        long numApproximateQueries = index->numApproximateQueries;
+        int id = nnIndexApproximateNearest(index, currJoint, &distance);
+        recordNNQuery(index, queryStart);
+        // queries that fell back to an exact one would only inflate the recall
+        if (index->numApproximateQueries > numApproximateQueries
+                && index->numApproximateQueries % NN_RECALL_SAMPLE_INTERVAL == 0) {
+            double exactDistance;
+            index->recallSamples++;
+            if (nnIndexNearest(index, currJoint, &exactDistance) == id)
+                index->recallHits++;
+        }
+        *closestNeighbor = (*tree)[id];
+        return distance;
+    }
+    if (NN_BACKEND != NN_LINEAR) {
+        double distance;
+        *closestNeighbor = (*tree)[nnIndexNearest(index, currJoint, &distance)];
+        recordNNQuery(index, queryStart);
+        return distance;
+    }
+
+    double closestNeighborDistance = (pow(2 * PI, 2) * numofDOFs);
+
+    for (int i = 0; i < tree->size(); i++) {
+        Node* neighbor = (*tree)[i];
+        double* neighborJoint = neighbor->joint;
+        double currNeighborDistance = 0;
+        for (int j = 0; j < numofDOFs; j++) {
+            currNeighborDistance += pow(fabs(neighborJoint[j] - currJoint[j]), 2);
+        }
+        //printf("***neighborJoint is , [%f, %f, %f, %f, %f]\n",
+        //            neighborJoint[0], neighborJoint[1], neighborJoint[2], neighborJoint[3], neighborJoint[4]);
+        if(currNeighborDistance < closestNeighborDistance) {
+            *closestNeighbor = neighbor;
+            closestNeighborDistance = currNeighborDistance;
+        }
+    }
+    recordNNQuery(index, queryStart);
+    return sqrt(closestNeighborDistance);
+}
+
+// Given currJoint and joints (all the existing joints),
+// sets closestNeighbor to the joint within joints that's closest to currJoint
+// and also returns the distance between closestNeighbor and currJoint
+double getClosestNeighborFromTreeAndNearNodes(double* currJoint, vector<Node*>* tree, NNIndex* index, int numofDOFs, Node** closestNeighbor,
+        vector<Node*>* nearNodes, vector<double>* nearNodeDistances, double radius) {
+
+    clock_t queryStart = clock();
+    if (NN_BACKEND != NN_LINEAR) {
+        vector<int> ids;
+        nnIndexRadius(index, currJoint, radius, &ids, nearNodeDistances);
+        for (int i = 0; i < ids.size(); i++) {
+            nearNodes->push_back((*tree)[ids[i]]);
+        }
+        double distance;
+        *closestNeighbor = (*tree)[nnIndexNearest(index, currJoint, &distance)];
+        recordNNQuery(index, queryStart);
+        return distance;
+    }
+
+    radius = pow(radius, 2);
+    double closestNeighborDistance = (pow(2 * PI, 2) * numofDOFs);
+
+    for (int i = 0; i < tree->size(); i++) {
+        Node* neighbor = (*tree)[i];
+        double* neighborJoint = neighbor->joint;
+        double currNeighborDistance = 0;
+        for (int j = 0; j < numofDOFs; j++) {
+            currNeighborDistance += pow(fabs(neighborJoint[j] - currJoint[j]), 2);
+        }
+        //printf("***neighborJoint is , [%f, %f, %f, %f, %f]\n",
+        //            neighborJoint[0], neighborJoint[1], neighborJoint[2], neighborJoint[3], neighborJoint[4]);
+        if(currNeighborDistance < closestNeighborDistance) {
+            *closestNeighbor = neighbor;
+            closestNeighborDistance = currNeighborDistance;
+        }
+        if (currNeighborDistance <= radius) {
+            nearNodes->push_back(neighbor);
+            nearNodeDistances->push_back(sqrt(currNeighborDistance));
+        }
+    }
+    recordNNQuery(index, queryStart);
+    return sqrt(closestNeighborDistance);
+}
+
+// Walks the same interpolation steps as the linear checker, but whenever the
+// clearance map certifies a step it skips every following step that lies
+// inside that step's safe ball
+template <int DOF>
+static int isJointTransitionValidSafeBall(double distance, double discretizationStep, int dynamicDOFs, double* currJoint, double* closestNeighbor,
+        WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double* tempJoint = getEdgeScratch(worldMap, 2 * numofDOFs);
+    double* direction = tempJoint + numofDOFs;
+    for (int j = 0; j < numofDOFs; j++) {
+        direction[j] = (currJoint[j] - closestNeighbor[j])/distance;
+    }
+    int valid = 1;
+    int numSteps = ((int) (distance/discretizationStep));
+    int i = 1;
+    while (i <= numSteps) {
+        for (int j = 0; j < numofDOFs; j++) {
+            tempJoint[j] = closestNeighbor[j] + (i * discretizationStep) * direction[j];
+        }
+        worldMap->stats.edgeStepsChecked++;
+        double safeRadius = getSafeJointRadius<DOF>(tempJoint, direction, numofDOFs, worldMap);
+        if (safeRadius > 0) {
+            i += 1 + (int) (safeRadius/discretizationStep);
+        } else if (IsValidArmConfigurationCached<DOF>(tempJoint, numofDOFs, worldMap)) {
+            i++;
+        } else {
+            valid = 0;
+            break;
+        }
+    }
+    return valid;
+}
+
+// Checks the interpolation steps FK_BATCH_SIZE at a time with the batched
+// forward kinematics, stopping after the first batch that holds a collision
+template <int DOF>
+static int isJointTransitionValidBatched(double distance, double discretizationStep, int dynamicDOFs, double* currJoint, double* closestNeighbor,
+        WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double* batchJoints = getEdgeScratch(worldMap, numofDOFs * FK_BATCH_SIZE);
+    unsigned char valid[FK_BATCH_SIZE];
+    int transitionValid = 1;
+    int numSteps = ((int) (distance/discretizationStep));
+    for (int first = 1; first <= numSteps && transitionValid; first += FK_BATCH_SIZE) {
+        int batchSize = MIN(FK_BATCH_SIZE, numSteps - first + 1);
+        for (int j = 0; j < numofDOFs; j++) {
+            double direction = (currJoint[j] - closestNeighbor[j])/distance;
+            for (int c = 0; c < batchSize; c++) {
+                batchJoints[j * batchSize + c] = closestNeighbor[j] + ((first + c) * discretizationStep) * direction;
+            }
+        }
+        IsValidArmConfigurationBatch<DOF>(batchJoints, batchSize, numofDOFs, worldMap, valid);
+        worldMap->stats.edgeStepsChecked += batchSize;
+        for (int c = 0; c < batchSize; c++) {
+            if (!valid[c]) {
+                transitionValid = 0;
+                break;
+            }
+        }
+    }
+    return transitionValid;
+}
+
+// Every link angle moves by the same increment between two interpolation
+// steps, so instead of calling cos/sin for every link of every step this
+// checker rotates the link directions of the previous step by that increment
+template <int DOF>
+static int isJointTransitionValidIncremental(double distance, double discretizationStep, int dynamicDOFs, double* currJoint, double* closestNeighbor,
+        WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double* linkCos = getEdgeScratch(worldMap, 4 * numofDOFs);
+    double* linkSin = linkCos + numofDOFs;
+    double* stepCos = linkSin + numofDOFs;
+    double* stepSin = stepCos + numofDOFs;
+    for (int j = 0; j < numofDOFs; j++) {
+        double angleStep = discretizationStep * ((currJoint[j] - closestNeighbor[j])/distance);
+        stepCos[j] = cos(angleStep);
+        stepSin[j] = sin(angleStep);
+    }
+
+    int valid = 1;
+    int numSteps = ((int) (distance/discretizationStep));
+    for (int i = 1; i <= numSteps && valid; i++) {
+        worldMap->stats.edgeStepsChecked++;
+        for (int j = 0; j < numofDOFs; j++) {
+            if ((i - 1) % FK_RESEED_INTERVAL == 0) {
+                double angle = closestNeighbor[j] + (i * discretizationStep) * ((currJoint[j] - closestNeighbor[j])/distance);
+                linkCos[j] = cos(2*PI-angle);
+                linkSin[j] = sin(2*PI-angle);
+            } else {
+                // the link angle grows by the step, so 2*PI-angle shrinks by it
+                double prevCos = linkCos[j];
+                linkCos[j] = prevCos * stepCos[j] + linkSin[j] * stepSin[j];
+                linkSin[j] = linkSin[j] * stepCos[j] - prevCos * stepSin[j];
+            }
+        }
+
+        double x0,y0,x1,y1;
+        x1 = ((double)worldMap->x_size)/2.0;
+        y1 = 0;
+        for (int j = 0; j < numofDOFs; j++) {
+            x0 = x1;
+            y0 = y1;
+            x1 = x0 + LINKLENGTH_CELLS*linkCos[j];
+            y1 = y0 - LINKLENGTH_CELLS*linkSin[j];
+            if (!IsValidLineSegment(x0,y0,x1,y1,worldMap)) {
+                valid = 0;
+                break;
+            }
+        }
+    }
+    return valid;
+}
+
+// Checks the interpolation steps in van der Corput order: the far end first,
+// then the middle, then the quarter points and so on.  An obstacle anywhere
+// along the edge is hit after a few checks instead of after walking up to it.
+template <int DOF>
+static int isJointTransitionValidBisection(double distance, double discretizationStep, int dynamicDOFs, double* currJoint, double* closestNeighbor,
+        WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double* tempJoint = getEdgeScratch(worldMap, numofDOFs);
+    int numSteps = ((int) (distance/discretizationStep));
+    int numBits = 0;
+    while ((1 << numBits) < numSteps) {
+        numBits++;
+    }
+    int valid = 1;
+    for (int k = 0; k < (1 << numBits) && valid; k++) {
+        int reversed = 0;
+        for (int b = 0; b < numBits; b++) {
+            reversed |= ((k >> b) & 1) << (numBits - 1 - b);
+        }
+        if (reversed >= numSteps)
+            continue;
+        int i = numSteps - reversed;
+        for (int j = 0; j < numofDOFs; j++) {
+            tempJoint[j] = closestNeighbor[j] + (i * discretizationStep) * ((currJoint[j] - closestNeighbor[j])/distance);
+        }
+        worldMap->stats.edgeStepsChecked++;
+        valid = IsValidArmConfigurationCached<DOF>(tempJoint, numofDOFs, worldMap);
+    }
+    return valid;
+}
+
+template <int DOF>
+static int isJointTransitionValid(double distance, double discretizationStep, int dynamicDOFs, double* currJoint, double* closestNeighbor,
+        WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    worldMap->stats.edgeChecks++;
+    worldMap->stats.edgeSteps += (int) (distance/discretizationStep);
+    if (EDGE_CHECK == EDGE_CHECK_SAFEBALL)
+        return isJointTransitionValidSafeBall<DOF>(distance, discretizationStep, numofDOFs, currJoint, closestNeighbor, worldMap);
+    if (EDGE_CHECK == EDGE_CHECK_BATCHED)
+        return isJointTransitionValidBatched<DOF>(distance, discretizationStep, numofDOFs, currJoint, closestNeighbor, worldMap);
+    if (EDGE_CHECK == EDGE_CHECK_INCREMENTAL)
+        return isJointTransitionValidIncremental<DOF>(distance, discretizationStep, numofDOFs, currJoint, closestNeighbor, worldMap);
+    if (EDGE_CHECK == EDGE_CHECK_BISECTION)
+        return isJointTransitionValidBisection<DOF>(distance, discretizationStep, numofDOFs, currJoint, closestNeighbor, worldMap);
+
+    double* tempJoint = getEdgeScratch(worldMap, numofDOFs);
+    int numSteps = ((int) (distance/discretizationStep));
+    for (int i = 1; i <= numSteps; i++) {
+        for (int j = 0; j < numofDOFs; j++) {
+            tempJoint[j] = closestNeighbor[j] + (i * discretizationStep) * ((currJoint[j] - closestNeighbor[j])/distance);
+        }
+        worldMap->stats.edgeStepsChecked++;
+        if (!IsValidArmConfigurationCached<DOF>(tempJoint, numofDOFs, worldMap))
+            return 0;
+    }
+    return 1;
+}
+
+template <int DOF>
+static double getJointDistance(double* joint, double* otherJoint, int dynamicDOFs) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double distance = 0;
+    for (int j = 0; j < numofDOFs; j++) {
+        distance += (joint[j] - otherJoint[j]) * (joint[j] - otherJoint[j]);
+    }
+    return sqrt(distance);
+}
+
+// Hangs node, which has no parent yet, below parent
+static void attachTreeNode(Node* node, Node* parent) {
+    node->parent = parent;
+    node->nextSibling = parent->firstChild;
+    parent->firstChild = node;
+}
+
+// Takes node out of the children of its parent
+static void detachTreeNode(Node* node) {
+    Node** link = &node->parent->firstChild;
+    while (*link != node)
+        link = &(*link)->nextSibling;
+    *link = node->nextSibling;
+    node->parent = 0;
+}
+
+// Moves node below parent, along an edge of length, and lowers the cost of
+// everything below node by as much as its own cost drops, so that the cost of
+// every node stays the length of its path from the root
+static void rewireTreeNode(Node* node, Node* parent, double length) {
+    detachTreeNode(node);
+    attachTreeNode(node, parent);
+    double costDrop = node->cost - (parent->cost + length);
+    node->cost = parent->cost + length;
+    node->nodeNum = parent->nodeNum + 1;
+    // depth first through the subtree, climbing back up by the parent links
+    Node* child = node->firstChild;
+    while (child != 0) {
+        child->cost -= costDrop;
+        child->nodeNum = child->parent->nodeNum + 1;
+        if (child->firstChild != 0) {
+            child = child->firstChild;
+            continue;
+        }
+        while (child != node && child->nextSibling == 0)
+            child = child->parent;
+        child = (child == node) ? 0 : child->nextSibling;
+    }
+}
+
+// Removes cutNode and every node whose path to the root runs through it from
+// tree.  Their memory stays in the arena of the run.
+static void pruneSubtree(Node* cutNode, vector<Node*>* tree) {
+    detachTreeNode(cutNode);
+    map<Node*, int> inSubtree;
+    inSubtree[cutNode] = 1;
+    vector<Node*> path;
+    for (int i = 0; i < tree->size(); i++) {
+        Node* node = (*tree)[i];
+        path.clear();
+        while (node != 0 && inSubtree.find(node) == inSubtree.end()) {
+            path.push_back(node);
+            node = node->parent;
+        }
+        int removed = (node != 0 && inSubtree[node]);
+        for (int j = 0; j < path.size(); j++) {
+            inSubtree[path[j]] = removed;
+        }
+    }
+    int numKept = 0;
+    for (int i = 0; i < tree->size(); i++) {
+        Node* node = (*tree)[i];
+        if (!inSubtree[node])
+            (*tree)[numKept++] = node;
+    }
+    tree->resize(numKept);
+}
+
+// Whether node still hangs below root, rather than in a subtree pruneSubtree cut off
+static int treeNodeReachesRoot(Node* node, Node* root) {
+    while (node->parent != 0)
+        node = node->parent;
+    return node == root;
+}
+
+// Lazily checks the unchecked edges on the path from root to node.  The
+// colliding edge closest to root is cut together with everything below it, in
+// which case node is no longer in tree (its memory stays in the arena) and 0 is
+// returned.  So is 0 if an earlier cut already separated node from root.
+template <int DOF>
+static int validateTreePath(Node* node, Node* root, vector<Node*>* tree, double discretizationStep, int dynamicDOFs,
+        WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    vector<Node*> path;
+    Node* top = node;
+    for (; top->parent != 0; top = top->parent) {
+        path.push_back(top);
+    }
+    if (top != root)
+        return 0;
+    for (int i = path.size() - 1; i >= 0; i--) {
+        Node* child = path[i];
+        if (child->edgeChecked)
+            continue;
+        double distance = getJointDistance<DOF>(child->joint, child->parent->joint, numofDOFs);
+        if (!isJointTransitionValid<DOF>(distance, discretizationStep, numofDOFs, child->joint, child->parent->joint, worldMap)) {
+            pruneSubtree(child, tree);
+            return 0;
+        }
+        child->edgeChecked = 1;
+    }
+    return 1;
+}
+
+static void generateRandomJoint(double** joint, int numofDOFs) {
+    for (int i = 0; i < numofDOFs; i++) {
+        (*joint)[i] = (rand() / (RAND_MAX/(2 * PI )));
+    }
+}
+
+// Standard normal sample, from two uniform ones by the Box-Muller transform
+static double generateGaussian() {
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = rand() / (RAND_MAX + 1.0);
+    return sqrt(-2 * log(u1)) * cos(2 * PI * u2);
+}
+
+// The prolate hyperspheroid of the joints a path from startJoint to goalJoint
+// of cost at most bestCost can pass through.  Everything but the radii only
+// depends on the two joints, so it is set up once per run.
+typedef struct {
+    double* startJoint;
+    double* goalJoint;
+    double minCost; // distance from startJoint to goalJoint
+    double* axis; // reflection axis e1 - (goalJoint - startJoint) / minCost
+    double axisNorm; // its squared norm
+    double bestCost; // the cost the radii are for, -1 before setInformedSamplerCost
+    double longRadius;
+    double shortRadius;
+} InformedSampler;
+
+// Sets up sampler for the paths from startJoint to goalJoint, with axis room
+// for numofDOFs doubles that outlives it
+template <int DOF>
+static void initInformedSampler(InformedSampler* sampler, double* startJoint, double* goalJoint, double* axis, int dynamicDOFs) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double minCost = getJointDistance<DOF>(startJoint, goalJoint, numofDOFs);
+    sampler->startJoint = startJoint;
+    sampler->goalJoint = goalJoint;
+    sampler->minCost = minCost;
+    sampler->axis = axis;
+    sampler->axisNorm = 0;
+    for (int i = 0; i < numofDOFs; i++) {
+        axis[i] = (i == 0) - (minCost > 0 ? (goalJoint[i] - startJoint[i]) / minCost : (i == 0));
+        sampler->axisNorm += axis[i] * axis[i];
+    }
+    sampler->bestCost = -1;
+}
+
+// Updates the radii of sampler when the best solution cost has changed
+static void setInformedSamplerCost(InformedSampler* sampler, double bestCost) {
+    if (bestCost == sampler->bestCost)
+        return;
+    sampler->bestCost = bestCost;
+    sampler->longRadius = bestCost / 2;
+    sampler->shortRadius = sqrt(MAX(bestCost * bestCost - sampler->minCost * sampler->minCost, 0.0)) / 2;
+}
+
+// Samples a joint uniformly from the hyperspheroid of sampler.  A sample of
+// the unit ball is stretched to its radii and turned onto the line from the
+// start to the goal by the Householder reflection that swaps it with the first
+// axis.  Joints outside [0, 2pi) are drawn again.
+template <int DOF>
+static void generateInformedJoint(double** joint, InformedSampler* sampler, int dynamicDOFs) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double* axis = sampler->axis;
+    double* x = *joint;
+    int inside = 0;
+    while (!inside) {
+        double norm = 0;
+        for (int i = 0; i < numofDOFs; i++) {
+            x[i] = generateGaussian();
+            norm += x[i] * x[i];
+        }
+        double scale = pow(rand() / (RAND_MAX + 1.0), 1.0 / numofDOFs) / sqrt(norm);
+        double dot = 0;
+        for (int i = 0; i < numofDOFs; i++) {
+            x[i] *= scale * (i == 0 ? sampler->longRadius : sampler->shortRadius);
+            dot += axis[i] * x[i];
+        }
+        inside = 1;
+        for (int i = 0; i < numofDOFs; i++) {
+            if (sampler->axisNorm > 1e-12)
+                x[i] -= 2 * dot / sampler->axisNorm * axis[i];
+            x[i] += (sampler->startJoint[i] + sampler->goalJoint[i]) / 2;
+            if (x[i] < 0 || x[i] >= 2 * PI)
+                inside = 0;
+        }
+    }
+}
+
+// Whether plan starts exactly at startJoint.  A lazily checked tree that loses
+// its path to the root to a cut edge would return one that does not.
+static int planStartsAt(double** plan, int planlength, double* startJoint, int numofDOFs) {
+    for (int j = 0; j < numofDOFs; j++) {
+        if (plan[0][j] != startJoint[j])
+            return 0;
+    }
+    return 1;
+}
+
+static double getPlanQuality(double*** plan, int* planlength, int numofDOFs) {
+    double distance = 0;
+    for (int i = 0; i < *planlength - 1; i++) {
+        double* currPlan = (*plan)[i];
+        double* nextPlan = (*plan)[i+1];
+        double currDistance = 0;
+        for (int j = 0; j < numofDOFs; j++) {
+            currDistance += pow(fabs(currPlan[j] - nextPlan[j]), 2);
+        }
+        distance += sqrt(currDistance);
+    }
+    return distance;
+}
+
+template <int DOF>
+static ExperimentResult plannerRRTDOF(WorldMap* worldMap,
+        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int dynamicDOFs,
+        double*** plan, int* planlength) {
+
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    clock_t start = clock();
+    resetCollisionStats(worldMap);
+	//no plan by default
+	*plan = NULL;
+	*planlength = 0;
+
+    int discretizationFactor = getAngleDiscretizationFactor(numofDOFs);
+    double discretizationStep = (2 * PI)/discretizationFactor;
+    double epsilon = PI/4;
+    //printf("Discretization factor is %d and epsilon is %f\n", discretizationFactor, epsilon);
+
+    Arena* arena = createArena();
+	Node* startNode = (Node*) arenaAlloc(arena, sizeof(Node));
+    double* startJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
+    for (int i = 0; i < numofDOFs; i++) {
+        startJoint[i] = armstart_anglesV_rad[i];
+    }
+    startNode->joint = startJoint;
+    startNode->parent = 0;
+    startNode->nodeNum = 1;
+    startNode->edgeChecked = 1;
+    startNode->firstChild = 0;
+    vector<Node*>* nodes = new vector<Node*>();
+    nodes->push_back(startNode);
+    NNIndex* index = createNNIndex(numofDOFs);
+    nnIndexAdd(index, startJoint);
+    //printf("Created startTree and added startNode to it.\n");
+
+    double* currJoint;
+    Node* closestNeighbor;
+    int isGoalJoint = 0;
+    int checkLazily = 0;
+    while (1) {
+        if (((clock() - start ) / (double) CLOCKS_PER_SEC) > TIMELIMIT) {
+            delete nodes;
+            freeNNIndex(index);
+            freeArena(arena);
+            ExperimentResult result;
+            result.planningTime = -1;
+            return result;
+        }
+        if (rand() % 2 == 1) {
+            currJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
+            for (int i = 0; i < numofDOFs; i++) {
+                currJoint[i] = armgoal_anglesV_rad[i];
+            }
+            isGoalJoint = 1;
+        } else {
+            currJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
+            generateRandomJoint(&currJoint, numofDOFs);
+            isGoalJoint = 0;
+        }
+        // edges grown toward the goal are the same every time, so a lazily added
+        // one would just be added again after being cut: check those right away
+        checkLazily = LAZY_EDGE_VALIDATION && !isGoalJoint;
+        if(!IsValidArmConfigurationCached<DOF>(currJoint, numofDOFs, worldMap)) {
+            arenaRelease(arena, currJoint);
+            continue;
+        }
+
+        // Calculate closest neighbor
+        nnIndexRebuild(index, nodes);
+        double closestNeighborDistance = getClosestNeighborFromTree(currJoint, nodes, index, numofDOFs, &closestNeighbor);
+        //printf("closestNeighbor to currNode is, [%f, %f, %f, %f, %f]\n",
+        //            closestNeighbor[0], closestNeighbor[1], closestNeighbor[2], closestNeighbor[3], closestNeighbor[4]);
+        //printf("Distance between closestNeighbor and currNode is %f\n", closestNeighborDistance);
+        
+        if (closestNeighborDistance > epsilon) {
+            isGoalJoint = 0;
+            for (int j = 0; j < numofDOFs; j++) {
+                currJoint[j] = closestNeighbor->joint[j] + epsilon * ((currJoint[j] - closestNeighbor->joint[j])/closestNeighborDistance);
+            }
+            closestNeighborDistance = epsilon;
+            //printf("Distance was greater than epsilon(%f), so updated currJoint to [%f, %f, %f, %f, %f]\n",
+            //        epsilon, currJoint[0], currJoint[1], currJoint[2], currJoint[3], currJoint[4]);
+        }
+        
+        int jointTransitionValid = checkLazily || isJointTransitionValid<DOF>(closestNeighborDistance, discretizationStep, numofDOFs,
+                currJoint, closestNeighbor->joint, worldMap);
+        
+        if (jointTransitionValid) {
+            Node* currNode = (Node*) arenaAlloc(arena, sizeof(Node));
+            currNode->joint = currJoint;
+            currNode->firstChild = 0;
+            attachTreeNode(currNode, closestNeighbor);
+            currNode->nodeNum = closestNeighbor->nodeNum + 1;
+            currNode->edgeChecked = !checkLazily;
+            nodes->push_back(currNode);
+            nnIndexAdd(index, currJoint);
+
+            if (isGoalJoint && LAZY_EDGE_VALIDATION && !validateTreePath<DOF>(currNode, startNode, nodes, discretizationStep, numofDOFs, worldMap))
+                continue;
+
+            if (isGoalJoint) {
+                //printf("Reached goalJoint -- building plan of length %d.\n", jointPathLength[currJoint]);
+                *plan = (double**) malloc(currNode->nodeNum * sizeof(double*));
+                *planlength = currNode->nodeNum;
+
+                for (int i = *planlength - 1; i >= 0; i--) {
+                    (*plan)[i] = (double*) malloc(numofDOFs * sizeof(double));
+                    for(int j = 0; j < numofDOFs; j++){
+                        (*plan)[i][j] = currNode->joint[j];
+                    }
+                    currNode = currNode->parent;
+                }
+                ExperimentResult result;
+                result.planningTime = (clock() - start ) / (double) CLOCKS_PER_SEC;
+                result.numNodes = nodes->size();
+                result.planLength = *planlength;
+                result.planQuality = getPlanQuality(plan, planlength, numofDOFs);
+                recordCollisionStats(&result, worldMap);
+                recordNNStats(&result, index, 0);
+                recordArenaStats(&result, arena);
+                delete nodes;
+                freeNNIndex(index);
+                freeArena(arena);
+                //printf("Path has %d nodes and %d total nodes were generated in %f seconds with planQuality %f.\n", result.planLength, result.numNodes, result.planningTime, result.planQuality);
+                return result;
+            }
+        } else {
+            arenaRelease(arena, currJoint);
+        }
+        if (!jointTransitionValid && LAZY_EDGE_VALIDATION) {
+            // the node nearest to the goal keeps being picked for this extension,
+            // so make sure it is actually reachable before trying it again
+            validateTreePath<DOF>(closestNeighbor, startNode, nodes, discretizationStep, numofDOFs, worldMap);
+        }
+    }
+}
+
+static ExperimentResult plannerRRT(WorldMap* worldMap,
+        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int numofDOFs,
+        double*** plan, int* planlength) {
+    DISPATCH_ON_DOF(numofDOFs, plannerRRTDOF, (worldMap, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, plan, planlength))
+}
+
+template <int DOF>
+static ExperimentResult plannerRRTConnectDOF(WorldMap* worldMap,
+        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int dynamicDOFs,
+        double*** plan, int* planlength) {
+
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    clock_t start = clock();
+    resetCollisionStats(worldMap);
+
+	//no plan by default
+	*plan = NULL;
+	*planlength = 0;
+
+    int discretizationFactor = getAngleDiscretizationFactor(numofDOFs);
+    double discretizationStep = (2 * PI)/discretizationFactor;
+    double epsilon = PI/4;
+    //printf("Discretization factor is %d and epsilon is %f\n", discretizationFactor, epsilon);
+
+    Arena* arena = createArena();
+	Node* startNode = (Node*) arenaAlloc(arena, sizeof(Node));
+    double* startJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
+    for (int i = 0; i < numofDOFs; i++) {
+        startJoint[i] = armstart_anglesV_rad[i];
+    }
+    startNode->joint = startJoint;
+    startNode->parent = 0;
+    startNode->nodeNum = 1;
+    vector<Node*>* startTree = new vector<Node*>();
+    startTree->push_back(startNode);
+    NNIndex* startIndex = createNNIndex(numofDOFs);
+    nnIndexAdd(startIndex, startJoint);
+    //printf("Created startTree and added startNode to it.\n");
+
+    Node* goalNode = (Node*) arenaAlloc(arena, sizeof(Node));
+    double* goalJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
+    for (int i = 0; i < numofDOFs; i++) {
+        goalJoint[i] = armgoal_anglesV_rad[i];
+    }
+    goalNode->joint = goalJoint;
+    goalNode->parent = 0;
+    goalNode->nodeNum = 1;
+    vector<Node*>* goalTree = new vector<Node*>();
+    goalTree->push_back(goalNode);
+    NNIndex* goalIndex = createNNIndex(numofDOFs);
+    nnIndexAdd(goalIndex, goalNode->joint);
+    //printf("Created goalTree and added goalNode to it.\n");
+
+    vector<Node*>*  currTree = startTree;
+    NNIndex* currIndex = startIndex;
+    double* currJoint;
+    Node* closestNeighbor;
+    int isStartTree = 1;
+    while (1) {
+        if (((clock() - start ) / (double) CLOCKS_PER_SEC) > TIMELIMIT) {
+            delete startTree;
+            delete goalTree;
+            freeNNIndex(startIndex);
+            freeNNIndex(goalIndex);
+            freeArena(arena);
+            ExperimentResult result;
+            result.planningTime = -1;
+            return result;
+        }
+        /*if (isStartTree)
+            printf("Start tree iteration!\n");
+        else
+            printf("Goal tree iteration!\n");*/
+
+        currJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
+        for (int i = 0; i < numofDOFs; i++) {
+            currJoint[i] = (2 * PI ) * (((double)(rand() % discretizationFactor))/discretizationFactor);
+        }
+        if(!IsValidArmConfigurationPrefix<DOF>(currJoint, numofDOFs, worldMap)) {
+            arenaRelease(arena, currJoint);
+            continue;
+        }
+        //printf("currJoint = [%f, %f, %f, %f, %f]\n",
+        //	currJoint[0], currJoint[1], currJoint[2], currJoint[3], currJoint[4]);
+        double closestNeighborDistance = getClosestNeighborFromTree(currJoint, currTree, currIndex, numofDOFs, &closestNeighbor);
+
+        //printf("closestNeighbor to currJoint is %f away = [%f, %f, %f, %f, %f]\n", closestNeighborDistance,
+        //        closestNeighbor->joint[0], closestNeighbor->joint[1], closestNeighbor->joint[2],
+        //        closestNeighbor->joint[3], closestNeighbor->joint[4]);
+
+        if (closestNeighborDistance > epsilon) {
+            for (int j = 0; j < numofDOFs; j++) {
+                currJoint[j] = closestNeighbor->joint[j] + epsilon * ((currJoint[j] - closestNeighbor->joint[j])/closestNeighborDistance);
+            }
+            closestNeighborDistance = epsilon;
+        }
+        int jointTransitionValid = isJointTransitionValid<DOF>(closestNeighborDistance, discretizationStep, numofDOFs,
+                currJoint, closestNeighbor->joint, worldMap);
+        // printf("currJoint to neighborJoint valid = %d\n", jointTransitionValid);
+
+        Node* currNode;
+        if (jointTransitionValid) {
+            currNode = (Node*) arenaAlloc(arena, sizeof(Node));
+            currNode->joint = currJoint;
+            currNode->parent = closestNeighbor;
+            currNode->nodeNum = closestNeighbor->nodeNum + 1;
+            currTree->push_back(currNode);
+            nnIndexAdd(currIndex, currJoint);
+            // printf("currJoint was valid, so added it to lists -- there are now %d nodes.\n",  currTree->size());
+        } else {
+            arenaRelease(arena, currJoint);
+        }
+        
+        if (isStartTree) {
+            currTree = goalTree;
+            currIndex = goalIndex;
+            isStartTree = 0;
+        } else {
+            currTree = startTree;
+            currIndex = startIndex;
+            isStartTree = 1;
+        }
+        //printf("Swapped trees. isStartTree = %d\n",  isStartTree);
+        
+        if (jointTransitionValid) {
+            
+            // Calculate closest neighbor
+            closestNeighborDistance = getClosestNeighborFromTree(currJoint, currTree, currIndex, numofDOFs, &closestNeighbor);
+            //printf("closestNeighbor to currJoint is %f away = [%f, %f, %f, %f, %f]\n", closestNeighborDistance,
+            //    closestNeighbor->joint[0], closestNeighbor->joint[1], closestNeighbor->joint[2],
+            //    closestNeighbor->joint[3], closestNeighbor->joint[4]);
+
+            double* otherJoint;
+            while (closestNeighborDistance > epsilon) {
+                otherJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
+                for (int j = 0; j < numofDOFs; j++) {
+                    otherJoint[j] = closestNeighbor->joint[j] + epsilon * ((currJoint[j] - closestNeighbor->joint[j])/closestNeighborDistance);
+                }
+                //printf("otherJoint = [%f, %f, %f, %f, %f]\n",
+                //    otherJoint[0], otherJoint[1], otherJoint[2], otherJoint[3], otherJoint[4]);
+                int jointTransitionValid = isJointTransitionValid<DOF>(epsilon, discretizationStep, numofDOFs,
+                    otherJoint, closestNeighbor->joint, worldMap);
+                //printf("otherJoint to neighborJoint valid = %d\n", jointTransitionValid);
+
+                if (jointTransitionValid) {
+                    Node* otherNode = (Node*) arenaAlloc(arena, sizeof(Node));
+                    otherNode->joint = otherJoint;
+                    otherNode->parent = closestNeighbor;
+                    otherNode->nodeNum = closestNeighbor->nodeNum + 1;
+                    currTree->push_back(otherNode);
+                    nnIndexAdd(currIndex, otherJoint);
+                    closestNeighbor = otherNode;
+                    closestNeighborDistance -= epsilon;
+                } else {
+                    arenaRelease(arena, otherJoint);
+                    break;
+                }
+            }
+
+            if (closestNeighborDistance <= epsilon) {
+                Node* startTreeNode;
+                Node* goalTreeNode;
+                if (isStartTree) {
+                    startTreeNode = closestNeighbor;
+                    goalTreeNode = currNode;
+                } else {
+                    startTreeNode = currNode;
+                    goalTreeNode = closestNeighbor;
+                }
+                int startTreeLength = startTreeNode->nodeNum;
+                int goalTreeLength = goalTreeNode->nodeNum;
+                //printf("Connect succeeded!\n");
+                *planlength = startTreeLength + goalTreeLength;
+                *plan = (double**) malloc(*planlength * sizeof(double*));
+
+                // printf("Start side has %d nodes\n", startTreeLength);
+                for (int i = startTreeLength - 1; i >= 0; i--) {
+                    (*plan)[i] = (double*) malloc(numofDOFs * sizeof(double));
+                    for(int j = 0; j < numofDOFs; j++){
+                        (*plan)[i][j] = startTreeNode->joint[j];
+                    }
+                    startTreeNode = startTreeNode->parent;
+                }
+
+                // printf("Goal side has %d nodes\n", goalTreeNode->nodeNum);
+                for (int i = 0; i < goalTreeLength; i++) {
+                    (*plan)[i + startTreeLength] = (double*) malloc(numofDOFs * sizeof(double));
+                    for(int j = 0; j < numofDOFs; j++){
+                        (*plan)[i + startTreeLength][j] = goalTreeNode->joint[j];
+                    }
+                    goalTreeNode = goalTreeNode->parent;
+                }
+                /*for (int i = 0; i < *planlength; i++) {
+                    printf("Plan step %d = [%f, %f, %f, %f, %f]\n", i, (*plan)[i][0], (*plan)[i][1], (*plan)[i][2],
+                            (*plan)[i][3], (*plan)[i][4]);
+                }*/
+                ExperimentResult result;
+                result.planningTime = (clock() - start ) / (double) CLOCKS_PER_SEC;
+                result.numNodes = startTree->size() + goalTree->size();
+                result.planLength = *planlength;
+                result.planQuality = getPlanQuality(plan, planlength, numofDOFs);
+                recordCollisionStats(&result, worldMap);
+                recordNNStats(&result, startIndex, goalIndex);
+                recordArenaStats(&result, arena);
+                delete startTree;
+                delete goalTree;
+                freeNNIndex(startIndex);
+                freeNNIndex(goalIndex);
+                freeArena(arena);
+                //printf("Path has %d nodes and %d total nodes were generated in %f seconds with planQuality %f.\n", result.planLength, result.numNodes, result.planningTime, result.planQuality);
+                return result;
+            }
+        }
+    }
+}
+
+static ExperimentResult plannerRRTConnect(WorldMap* worldMap,
+        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int numofDOFs,
+        double*** plan, int* planlength) {
+    DISPATCH_ON_DOF(numofDOFs, plannerRRTConnectDOF, (worldMap, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, plan, planlength))
+}
+
+static double getRRTStarRadius(int numVertices, int numofDOFs, double epsilon) {
+    double calcRad = pow((1000 * log(numVertices)/numVertices), (1.0/numofDOFs));
+    return min(calcRad, epsilon);
+}
+
+template <int DOF>
+static ExperimentResult plannerRRTStarDOF(WorldMap* worldMap,
+        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int dynamicDOFs,
         double*** plan, int* planlength) {
 
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
     clock_t start = clock();
+    resetCollisionStats(worldMap);
+
 	//no plan by default
 	*plan = NULL;
 	*planlength = 0;
@@ -377,49 +2870,84 @@ static ExperimentResult plannerRRT(double* worldMap, int x_size, int y_size,
     int discretizationFactor = getAngleDiscretizationFactor(numofDOFs);
     double discretizationStep = (2 * PI)/discretizationFactor;
     double epsilon = PI/4;
-    //printf("Discretization factor is %d and epsilon is %f\n", discretizationFactor, epsilon);
 
-	Node* startNode = (Node*) malloc(sizeof(Node));
-    double* startJoint = (double*) malloc(numofDOFs * sizeof(double));
+    Arena* arena = createArena();
+	Node* startNode = (Node*) arenaAlloc(arena, sizeof(Node));
+    double* startJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
     for (int i = 0; i < numofDOFs; i++) {
         startJoint[i] = armstart_anglesV_rad[i];
     }
     startNode->joint = startJoint;
     startNode->parent = 0;
     startNode->nodeNum = 1;
+    startNode->cost = 0;
+    startNode->edgeChecked = 1;
+    startNode->firstChild = 0;
     vector<Node*>* nodes = new vector<Node*>();
     nodes->push_back(startNode);
+    NNIndex* index = createNNIndex(numofDOFs);
+    nnIndexAdd(index, startJoint);
+    InformedSampler informedSampler;
+    initInformedSampler<DOF>(&informedSampler, startJoint, armgoal_anglesV_rad,
+            (double*) arenaAlloc(arena, numofDOFs * sizeof(double)), numofDOFs);
     //printf("Created startTree and added startNode to it.\n");
+    vector<Node*>* nearNodes = new vector<Node*>();
+    vector<double>* nearNodeDistances = new vector<double>();
+    vector<int>* nearNodeObstacleFree = new vector<int>();
 
     double* currJoint;
     Node* closestNeighbor;
+    Node* goalNode;
     int isGoalJoint = 0;
+    int checkLazily = 0;
+    int numAfterGoal = -1;
+    double firstSolutionCost = 0;
     while (1) {
         if (((clock() - start ) / (double) CLOCKS_PER_SEC) > TIMELIMIT) {
+            delete nodes;
+            delete nearNodes;
+            delete nearNodeDistances;
+            delete nearNodeObstacleFree;
+            freeNNIndex(index);
+            freeArena(arena);
             ExperimentResult result;
             result.planningTime = -1;
             return result;
         }
-        if (rand() % 2 == 1) {
-            currJoint = (double*) malloc(numofDOFs * sizeof(double));
+        if (rand() % 2 == 1 && numAfterGoal == -1) {
+            currJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
             for (int i = 0; i < numofDOFs; i++) {
                 currJoint[i] = armgoal_anglesV_rad[i];
             }
             isGoalJoint = 1;
         } else {
-            currJoint = (double*) malloc(numofDOFs * sizeof(double));
-            generateRandomJoint(&currJoint, numofDOFs);
+            currJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
+            if (INFORMED_RRTSTAR && numAfterGoal != -1) {
+                setInformedSamplerCost(&informedSampler, goalNode->cost);
+                generateInformedJoint<DOF>(&currJoint, &informedSampler, numofDOFs);
+            } else
+                generateRandomJoint(&currJoint, numofDOFs);
             isGoalJoint = 0;
         }
-        if(!IsValidArmConfiguration(currJoint, numofDOFs, worldMap, x_size, y_size))
+        // edges grown toward the goal are the same every time, so a lazily added
+        // one would just be added again after being cut: check those right away
+        checkLazily = LAZY_EDGE_VALIDATION && !isGoalJoint;
+        if(!IsValidArmConfigurationCached<DOF>(currJoint, numofDOFs, worldMap)) {
+            arenaRelease(arena, currJoint);
             continue;
+        }
 
         // Calculate closest neighbor
-        double closestNeighborDistance = getClosestNeighborFromTree(currJoint, nodes, numofDOFs, &closestNeighbor);
-        //printf("closestNeighbor to currNode is, [%f, %f, %f, %f, %f]\n",
-        //            closestNeighbor[0], closestNeighbor[1], closestNeighbor[2], closestNeighbor[3], closestNeighbor[4]);
-        //printf("Distance between closestNeighbor and currNode is %f\n", closestNeighborDistance);
-        
+        double radius = getRRTStarRadius(nodes->size(), numofDOFs, epsilon);
+        nearNodes->clear();
+        nearNodeDistances->clear();
+
+        nnIndexRebuild(index, nodes);
+        double closestNeighborDistance = getClosestNeighborFromTreeAndNearNodes(
+                currJoint, nodes, index, numofDOFs, &closestNeighbor, nearNodes, nearNodeDistances, radius);
+
+        //printf("Radius = %f, Num nearest nodes = %d, total num nodes = %d\n", radius, nearNodes->size(), nodes->size());
+
         if (closestNeighborDistance > epsilon) {
             isGoalJoint = 0;
             for (int j = 0; j < numofDOFs; j++) {
@@ -429,454 +2957,1494 @@ static ExperimentResult plannerRRT(double* worldMap, int x_size, int y_size,
             //printf("Distance was greater than epsilon(%f), so updated currJoint to [%f, %f, %f, %f, %f]\n",
             //        epsilon, currJoint[0], currJoint[1], currJoint[2], currJoint[3], currJoint[4]);
         }
-        
-        int jointTransitionValid = isJointTransitionValid(closestNeighborDistance, discretizationStep, numofDOFs,
-                currJoint, closestNeighbor->joint, worldMap, x_size, y_size);
-        
+
+        int jointTransitionValid = checkLazily || isJointTransitionValid<DOF>(closestNeighborDistance, discretizationStep, numofDOFs,
+                currJoint, closestNeighbor->joint, worldMap);
+
         if (jointTransitionValid) {
-            Node* currNode = (Node*) malloc(sizeof(Node));
+
+            nearNodeObstacleFree->clear();
+
+            Node* minNode = closestNeighbor;
+            double minCost = closestNeighbor->cost + closestNeighborDistance;
+            for (int i = 0; i < nearNodes->size(); i++) {
+                int jointTransitionValid = checkLazily || isJointTransitionValid<DOF>((*nearNodeDistances)[i], discretizationStep, numofDOFs,
+                    currJoint, (*nearNodes)[i]->joint, worldMap);
+                
+                nearNodeObstacleFree->push_back(jointTransitionValid);
+                if (jointTransitionValid) {
+                    double currCost = (*nearNodes)[i]->cost + (*nearNodeDistances)[i];
+                    if (currCost < minCost) {
+                        minNode = (*nearNodes)[i];
+                        minCost = currCost;
+                    }
+                }
+            }
+            
+            Node* currNode = (Node*) arenaAlloc(arena, sizeof(Node));
             currNode->joint = currJoint;
-            currNode->parent = closestNeighbor;
-            currNode->nodeNum = closestNeighbor->nodeNum + 1;
+            currNode->firstChild = 0;
+            attachTreeNode(currNode, minNode);
+            currNode->nodeNum = minNode->nodeNum + 1;
+            currNode->cost = minCost;
+            currNode->edgeChecked = !checkLazily;
             nodes->push_back(currNode);
+            nnIndexAdd(index, currJoint);
+
+            for (int i = 0; i < nearNodes->size(); i++) {
+                if ((*nearNodes)[i] == minNode)
+                    continue;
+                double currCost = currNode->cost + (*nearNodeDistances)[i];
+                if ((*nearNodeObstacleFree)[i] && currCost < (*nearNodes)[i]->cost) {
+                    rewireTreeNode((*nearNodes)[i], currNode, (*nearNodeDistances)[i]);
+                    (*nearNodes)[i]->edgeChecked = !checkLazily;
+                }
+            }
+            
+            if (numAfterGoal > 0)
+                numAfterGoal--;
+            if (numAfterGoal == 0) {
+                if (!LAZY_EDGE_VALIDATION || validateTreePath<DOF>(goalNode, startNode, nodes, discretizationStep, numofDOFs, worldMap))
+                    break;
+                // the solution ran through a colliding edge and was cut off, look for the goal again
+                numAfterGoal = -1;
+                continue;
+            }
+
+            if (isGoalJoint) {
+                numAfterGoal = 1000; // Start the countdown!
+                //printf("Reached goalJoint -- expanding %d more nodes to improve path quality.\n", numAfterGoal);
+                goalNode = currNode;
+                firstSolutionCost = goalNode->cost;
+            }
+        } else {
+            arenaRelease(arena, currJoint);
+        }
+        if (!jointTransitionValid && LAZY_EDGE_VALIDATION) {
+            // the node nearest to the goal keeps being picked for this extension,
+            // so make sure it is actually reachable before trying it again
+            if (!validateTreePath<DOF>(closestNeighbor, startNode, nodes, discretizationStep, numofDOFs, worldMap) &&
+                    numAfterGoal != -1 && !treeNodeReachesRoot(goalNode, startNode)) {
+                // the cut took the solution with it, look for the goal again
+                numAfterGoal = -1;
+            }
+        }
+    }
+    Node* tempNode = goalNode;
+    int planLength = 1;
+    while(tempNode->parent != 0) {
+        planLength++;
+        tempNode = tempNode->parent;
+    }
+    //printf("Reached goalJoint -- building plan of length %d.\n", goalNode->nodeNum);
+    *plan = (double**) malloc(planLength * sizeof(double*));
+    *planlength = planLength;
+
+    //printf("startNode = [%f, %f, %f, %f, %f]\n",
+    //        startNode->joint[0], startNode->joint[1], startNode->joint[2],
+    //        startNode->joint[3], startNode->joint[4]);
+    for (int i = *planlength - 1; i >= 0; i--) {
+        //printf("plan[%d] = [%f, %f, %f, %f, %f]\n",
+        //    i, goalNode->joint[0], goalNode->joint[1], goalNode->joint[2],
+        //        goalNode->joint[3], goalNode->joint[4]);
+        (*plan)[i] = (double*) malloc(numofDOFs * sizeof(double));
+        for(int j = 0; j < numofDOFs; j++){
+            (*plan)[i][j] = goalNode->joint[j];
+        }
+        goalNode = goalNode->parent;
+    }
+    ExperimentResult result;
+    result.planningTime = (clock() - start ) / (double) CLOCKS_PER_SEC;
+    result.numNodes = nodes->size();
+    result.planLength = *planlength;
+    result.planQuality = getPlanQuality(plan, planlength, numofDOFs);
+    result.firstSolutionCost = firstSolutionCost;
+    recordCollisionStats(&result, worldMap);
+    recordNNStats(&result, index, 0);
+    recordArenaStats(&result, arena);
+    delete nodes;
+    delete nearNodes;
+    delete nearNodeDistances;
+    delete nearNodeObstacleFree;
+    freeNNIndex(index);
+    freeArena(arena);
+    //printf("Path has %d nodes and %d total nodes were generated in %f seconds with planQuality %f.\n", result.planLength, result.numNodes, result.planningTime, result.planQuality);
+    return result;
+}
+
+static ExperimentResult plannerRRTStar(WorldMap* worldMap,
+        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int numofDOFs,
+        double*** plan, int* planlength) {
+    DISPATCH_ON_DOF(numofDOFs, plannerRRTStarDOF, (worldMap, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, plan, planlength))
+}
+
+// Binary min-heap of node ids that knows where every node sits in it, so that
+// the key of a node already in the heap can be lowered
+typedef struct {
+    int size;
+    int* nodes;
+    double* keys; // key of nodes[i]
+    int* positions; // position of every node in nodes, -1 when it is not in the heap
+} IndexedHeap;
+
+IndexedHeap* createIndexedHeap(int numNodes) {
+    IndexedHeap* heap = (IndexedHeap*) malloc(sizeof(IndexedHeap));
+    heap->size = 0;
+    heap->nodes = (int*) malloc(numNodes * sizeof(int));
+    heap->keys = (double*) malloc(numNodes * sizeof(double));
+    heap->positions = (int*) malloc(numNodes * sizeof(int));
+    memset(heap->positions, -1, numNodes * sizeof(int));
+    return heap;
+}
+
+void freeIndexedHeap(IndexedHeap* heap) {
+    free(heap->nodes);
+    free(heap->keys);
+    free(heap->positions);
+    free(heap);
+}
+
+// Whether the entry at position i comes out before the one at position j;
+// equal keys go to the lower node id so that searches are deterministic
+static inline int indexedHeapBefore(IndexedHeap* heap, int i, int j) {
+    if (heap->keys[i] != heap->keys[j])
+        return heap->keys[i] < heap->keys[j];
+    return heap->nodes[i] < heap->nodes[j];
+}
+
+static void indexedHeapSwap(IndexedHeap* heap, int i, int j) {
+    int node = heap->nodes[i];
+    double key = heap->keys[i];
+    heap->nodes[i] = heap->nodes[j];
+    heap->keys[i] = heap->keys[j];
+    heap->nodes[j] = node;
+    heap->keys[j] = key;
+    heap->positions[heap->nodes[i]] = i;
+    heap->positions[heap->nodes[j]] = j;
+}
+
+static void indexedHeapSiftUp(IndexedHeap* heap, int i) {
+    while (i > 0 && indexedHeapBefore(heap, i, (i - 1) / 2)) {
+        indexedHeapSwap(heap, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void indexedHeapSiftDown(IndexedHeap* heap, int i) {
+    while (1) {
+        int first = i;
+        int left = 2 * i + 1;
+        int right = 2 * i + 2;
+        if (left < heap->size && indexedHeapBefore(heap, left, first))
+            first = left;
+        if (right < heap->size && indexedHeapBefore(heap, right, first))
+            first = right;
+        if (first == i)
+            return;
+        indexedHeapSwap(heap, i, first);
+        i = first;
+    }
+}
+
+// Adds node with key, or lowers its key to key if it is already in the heap
+static void indexedHeapPush(IndexedHeap* heap, int node, double key) {
+    int i = heap->positions[node];
+    if (i == -1) {
+        i = heap->size++;
+        heap->nodes[i] = node;
+        heap->positions[node] = i;
+    } else if (key >= heap->keys[i]) {
+        return;
+    }
+    heap->keys[i] = key;
+    indexedHeapSiftUp(heap, i);
+}
+
+static int indexedHeapPop(IndexedHeap* heap) {
+    int node = heap->nodes[0];
+    heap->size--;
+    if (heap->size > 0) {
+        indexedHeapSwap(heap, 0, heap->size);
+        indexedHeapSiftDown(heap, 0);
+    }
+    heap->positions[node] = -1;
+    return node;
+}
+
+// PRM roadmap.  Nodes are identified by the order they were added in; their
+// joints live in the arena of the run, since the NN index keeps pointers to
+// them.  While the roadmap grows, the edges of a node are kept in a chain of
+// ROADMAP_EDGE_BLOCK-edge blocks from a shared pool.  compactRoadmap moves
+// them into CSR arrays for searching, and the next change to the roadmap moves
+// them back.  Every edge is kept at both of its ends, together with its length
+// and whether it is known to be collision free.
+// Connected components are tracked in a disjoint-set forest as edges are added.
+// The start and goal of a query are attached as overlay nodes, see
+// addRoadmapOverlayNode, and dropped again once it is answered.
+// A roadmap loaded by loadRoadmapFile keeps the joints of its first nodes and,
+// until the first change, its CSR arrays in the mapping of the file.
+typedef struct {
+    int numofDOFs;
+    int size, capacity; // in nodes
+    double** joints;
+    int* degree;
+    int* component; // parent in the disjoint-set forest, roots are their own parent
+    int* componentRank;
+    int* pathParent; // node before this one on the path found by searchRoadmap
+    int* nodeNum; // number of nodes on that path up to this one, -1 if unreached
+    int numEdges;
+    long numExpansions; // nodes taken off the open list by searchRoadmap
+    double searchTime; // seconds spent in searchRoadmap
+    long numPathEdgesChecked; // by validateRoadmapPath
+    long numPathEdgesReused; // found already checked by validateRoadmapPath
+    long numPathEdgesCut;
+    int numCoverageNodes; // nodes the sparse roadmap added for each reason
+    int numConnectivityNodes;
+    int numQualityNodes;
+    long numSamplesRejected; // valid samples the sparse roadmap did not need
+    int searchCapacity; // nodes the search scratch below has room for
+    double* searchCost; // cost so far of every node the last search reached
+    unsigned char* searchClosed;
+    int* searchReached; // the nodes the last search reached, reset before the next one
+    int numSearchReached;
+    IndexedHeap* searchHeap;
+    int numOverlayNodes; // searches know overlay node i as node size + i
+    double* overlayJoints[ROADMAP_OVERLAY_NODES];
+    int numOverlayEdges, overlayEdgeCapacity;
+    int* overlayEdgeNodes; // overlay node each overlay edge starts at
+    int* overlayEdgeTargets; // node it ends at, or -1 - i for overlay node i
+    float* overlayEdgeLengths;
+    unsigned char* overlayEdgeChecked;
+    unsigned char* overlayAdjacent; // whether an overlay edge ends at the node
+    int compacted; // whether the edges are in the CSR arrays rather than the blocks
+    int* firstBlock; // -1 while the node has no edges
+    int numBlocks, blockCapacity;
+    int* blockNext; // -1 at the end of a chain
+    int* blockTargets;
+    float* blockLengths;
+    unsigned char* blockChecked;
+    int* edgeOffsets; // the edges of node i are edgeOffsets[i] to edgeOffsets[i+1]-1
+    int* edgeTargets;
+    float* edgeLengths;
+    unsigned char* edgeChecked;
+    void* file; // mapping of the roadmap file, 0 if there is none
+    size_t fileBytes;
+    int edgesInFile; // whether the CSR arrays point into file
+} Roadmap;
+
+Roadmap* createRoadmap(int numofDOFs) {
+    Roadmap* roadmap = (Roadmap*) malloc(sizeof(Roadmap));
+    roadmap->numofDOFs = numofDOFs;
+    roadmap->size = 0;
+    roadmap->capacity = 1024;
+    roadmap->joints = (double**) malloc(roadmap->capacity * sizeof(double*));
+    roadmap->degree = (int*) malloc(roadmap->capacity * sizeof(int));
+    roadmap->component = (int*) malloc(roadmap->capacity * sizeof(int));
+    roadmap->componentRank = (int*) malloc(roadmap->capacity * sizeof(int));
+    roadmap->pathParent = (int*) malloc(roadmap->capacity * sizeof(int));
+    roadmap->nodeNum = (int*) malloc(roadmap->capacity * sizeof(int));
+    roadmap->numEdges = 0;
+    roadmap->numExpansions = 0;
+    roadmap->searchTime = 0;
+    roadmap->numPathEdgesChecked = 0;
+    roadmap->numPathEdgesReused = 0;
+    roadmap->numPathEdgesCut = 0;
+    roadmap->numCoverageNodes = 0;
+    roadmap->numConnectivityNodes = 0;
+    roadmap->numQualityNodes = 0;
+    roadmap->numSamplesRejected = 0;
+    roadmap->searchCapacity = 0;
+    roadmap->searchCost = 0;
+    roadmap->searchClosed = 0;
+    roadmap->searchReached = 0;
+    roadmap->numSearchReached = 0;
+    roadmap->searchHeap = 0;
+    roadmap->numOverlayNodes = 0;
+    roadmap->numOverlayEdges = 0;
+    roadmap->overlayEdgeCapacity = 0;
+    roadmap->overlayEdgeNodes = 0;
+    roadmap->overlayEdgeTargets = 0;
+    roadmap->overlayEdgeLengths = 0;
+    roadmap->overlayEdgeChecked = 0;
+    roadmap->overlayAdjacent = (unsigned char*) malloc(roadmap->capacity);
+    roadmap->compacted = 0;
+    roadmap->firstBlock = (int*) malloc(roadmap->capacity * sizeof(int));
+    roadmap->numBlocks = 0;
+    roadmap->blockCapacity = 0;
+    roadmap->blockNext = 0;
+    roadmap->blockTargets = 0;
+    roadmap->blockLengths = 0;
+    roadmap->blockChecked = 0;
+    roadmap->edgeOffsets = (int*) malloc((roadmap->capacity + 1) * sizeof(int));
+    roadmap->edgeTargets = 0;
+    roadmap->edgeLengths = 0;
+    roadmap->edgeChecked = 0;
+    roadmap->file = 0;
+    roadmap->fileBytes = 0;
+    roadmap->edgesInFile = 0;
+    return roadmap;
+}
+
+static void freeRoadmapBlocks(Roadmap* roadmap) {
+    free(roadmap->blockNext);
+    free(roadmap->blockTargets);
+    free(roadmap->blockLengths);
+    free(roadmap->blockChecked);
+    roadmap->numBlocks = 0;
+    roadmap->blockCapacity = 0;
+    roadmap->blockNext = 0;
+    roadmap->blockTargets = 0;
+    roadmap->blockLengths = 0;
+    roadmap->blockChecked = 0;
+}
+
+static void unmapRoadmapFile(void* file, size_t fileBytes);
+
+void freeRoadmap(Roadmap* roadmap) {
+    free(roadmap->joints);
+    free(roadmap->degree);
+    free(roadmap->component);
+    free(roadmap->componentRank);
+    free(roadmap->pathParent);
+    free(roadmap->nodeNum);
+    free(roadmap->firstBlock);
+    free(roadmap->searchCost);
+    free(roadmap->searchClosed);
+    free(roadmap->searchReached);
+    if (roadmap->searchHeap != 0)
+        freeIndexedHeap(roadmap->searchHeap);
+    free(roadmap->overlayEdgeNodes);
+    free(roadmap->overlayEdgeTargets);
+    free(roadmap->overlayEdgeLengths);
+    free(roadmap->overlayEdgeChecked);
+    free(roadmap->overlayAdjacent);
+    freeRoadmapBlocks(roadmap);
+    free(roadmap->edgeOffsets);
+    if (!roadmap->edgesInFile) {
+        free(roadmap->edgeTargets);
+        free(roadmap->edgeLengths);
+        free(roadmap->edgeChecked);
+    }
+    if (roadmap->file != 0)
+        unmapRoadmapFile(roadmap->file, roadmap->fileBytes);
+    free(roadmap);
+}
+
+// Bytes of heap held by the arrays of roadmap, not counting the joints
+static long getRoadmapBytes(Roadmap* roadmap) {
+    long bytes = sizeof(Roadmap);
+    bytes += (long) roadmap->capacity * (sizeof(double*) + 7 * sizeof(int) + 1);
+    bytes += (long) roadmap->blockCapacity * (sizeof(int) + ROADMAP_EDGE_BLOCK * (sizeof(int) + sizeof(float) + 1));
+    if (roadmap->compacted && !roadmap->edgesInFile)
+        bytes += (long) 2 * roadmap->numEdges * (sizeof(int) + sizeof(float) + 1);
+    return bytes;
+}
+
+static inline double* getRoadmapJoint(Roadmap* roadmap, int node) {
+    return roadmap->joints[node];
+}
+
+// Returns the root of the component of node, halving the path to it on the way
+static int findRoadmapComponent(Roadmap* roadmap, int node) {
+    int* component = roadmap->component;
+    while (component[node] != node) {
+        component[node] = component[component[node]];
+        node = component[node];
+    }
+    return node;
+}
+
+static void joinRoadmapComponents(Roadmap* roadmap, int node, int otherNode) {
+    int root = findRoadmapComponent(roadmap, node);
+    int otherRoot = findRoadmapComponent(roadmap, otherNode);
+    if (root == otherRoot)
+        return;
+    if (roadmap->componentRank[root] < roadmap->componentRank[otherRoot]) {
+        int temp = root;
+        root = otherRoot;
+        otherRoot = temp;
+    }
+    roadmap->component[otherRoot] = root;
+    if (roadmap->componentRank[root] == roadmap->componentRank[otherRoot])
+        roadmap->componentRank[root]++;
+}
+
+static inline int roadmapNodesConnected(Roadmap* roadmap, int node, int otherNode) {
+    return findRoadmapComponent(roadmap, node) == findRoadmapComponent(roadmap, otherNode);
+}
+
+static int newRoadmapBlock(Roadmap* roadmap) {
+    if (roadmap->numBlocks == roadmap->blockCapacity) {
+        roadmap->blockCapacity = MAX(2 * roadmap->blockCapacity, 1024);
+        roadmap->blockNext = (int*) realloc(roadmap->blockNext, roadmap->blockCapacity * sizeof(int));
+        roadmap->blockTargets = (int*) realloc(roadmap->blockTargets,
+                roadmap->blockCapacity * ROADMAP_EDGE_BLOCK * sizeof(int));
+        roadmap->blockLengths = (float*) realloc(roadmap->blockLengths,
+                roadmap->blockCapacity * ROADMAP_EDGE_BLOCK * sizeof(float));
+        roadmap->blockChecked = (unsigned char*) realloc(roadmap->blockChecked,
+                roadmap->blockCapacity * ROADMAP_EDGE_BLOCK);
+    }
+    roadmap->blockNext[roadmap->numBlocks] = -1;
+    return roadmap->numBlocks++;
+}
+
+// Returns the block holding edge end position of node, adding the blocks the
+// chain of node is missing up to there
+static int getRoadmapBlock(Roadmap* roadmap, int node, int position) {
+    if (roadmap->firstBlock[node] == -1) {
+        int block = newRoadmapBlock(roadmap);
+        roadmap->firstBlock[node] = block;
+    }
+    int block = roadmap->firstBlock[node];
+    for (int i = 0; i < position / ROADMAP_EDGE_BLOCK; i++) {
+        if (roadmap->blockNext[block] == -1) {
+            int next = newRoadmapBlock(roadmap);
+            roadmap->blockNext[block] = next;
+        }
+        block = roadmap->blockNext[block];
+    }
+    return block;
+}
 
-            if (isGoalJoint) {
-                //printf("Reached goalJoint -- building plan of length %d.\n", jointPathLength[currJoint]);
-                *plan = (double**) malloc(currNode->nodeNum * sizeof(double*));
-                *planlength = currNode->nodeNum;
+static void addRoadmapEdgeEnd(Roadmap* roadmap, int node, int target, float length, int checked) {
+    int position = roadmap->degree[node]++;
+    int slot = getRoadmapBlock(roadmap, node, position) * ROADMAP_EDGE_BLOCK + position % ROADMAP_EDGE_BLOCK;
+    roadmap->blockTargets[slot] = target;
+    roadmap->blockLengths[slot] = length;
+    roadmap->blockChecked[slot] = checked;
+}
 
-                for (int i = *planlength - 1; i >= 0; i--) {
-                    (*plan)[i] = (double*) malloc(numofDOFs * sizeof(double));
-                    for(int j = 0; j < numofDOFs; j++){
-                        (*plan)[i][j] = currNode->joint[j];
-                    }
-                    currNode = currNode->parent;
-                }
-                ExperimentResult result;
-                result.planningTime = (clock() - start ) / (double) CLOCKS_PER_SEC;
-                result.numNodes = nodes->size();
-                result.planLength = *planlength;
-                result.planQuality = getPlanQuality(plan, planlength, numofDOFs);
-                for(int i = 0; i < nodes->size(); i++) {
-                    free((*nodes)[i]->joint);
-                    free((*nodes)[i]);
-                }
-                //printf("Path has %d nodes and %d total nodes were generated in %f seconds with planQuality %f.\n", result.planLength, result.numNodes, result.planningTime, result.planQuality);
-                return result;
+// Moves the edges of roadmap from the CSR arrays back into blocks, chaining the
+// blocks of every node as they fill up rather than walking its chain per edge
+static void expandRoadmap(Roadmap* roadmap) {
+    if (!roadmap->compacted)
+        return;
+    for (int node = 0; node < roadmap->size; node++) {
+        roadmap->degree[node] = roadmap->edgeOffsets[node + 1] - roadmap->edgeOffsets[node];
+        roadmap->firstBlock[node] = -1;
+        int block = -1;
+        for (int k = 0; k < roadmap->degree[node]; k++) {
+            if (k % ROADMAP_EDGE_BLOCK == 0) {
+                int next = newRoadmapBlock(roadmap);
+                if (block == -1)
+                    roadmap->firstBlock[node] = next;
+                else
+                    roadmap->blockNext[block] = next;
+                block = next;
             }
+            int e = roadmap->edgeOffsets[node] + k;
+            int slot = block * ROADMAP_EDGE_BLOCK + k % ROADMAP_EDGE_BLOCK;
+            roadmap->blockTargets[slot] = roadmap->edgeTargets[e];
+            roadmap->blockLengths[slot] = roadmap->edgeLengths[e];
+            roadmap->blockChecked[slot] = roadmap->edgeChecked[e];
         }
     }
+    if (!roadmap->edgesInFile) {
+        free(roadmap->edgeTargets);
+        free(roadmap->edgeLengths);
+        free(roadmap->edgeChecked);
+    }
+    roadmap->edgeTargets = 0;
+    roadmap->edgeLengths = 0;
+    roadmap->edgeChecked = 0;
+    roadmap->edgesInFile = 0;
+    roadmap->compacted = 0;
 }
 
-static ExperimentResult plannerRRTConnect(double* worldMap, int x_size, int y_size,
-        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int numofDOFs,
-        double*** plan, int* planlength) {
+// Moves the edges of roadmap from the blocks into the CSR arrays, in the same order
+static void compactRoadmap(Roadmap* roadmap) {
+    if (roadmap->compacted)
+        return;
+    roadmap->edgeTargets = (int*) malloc(MAX(2 * roadmap->numEdges, 1) * sizeof(int));
+    roadmap->edgeLengths = (float*) malloc(MAX(2 * roadmap->numEdges, 1) * sizeof(float));
+    roadmap->edgeChecked = (unsigned char*) malloc(MAX(2 * roadmap->numEdges, 1));
+    int numEdgeEnds = 0;
+    for (int node = 0; node < roadmap->size; node++) {
+        roadmap->edgeOffsets[node] = numEdgeEnds;
+        int block = roadmap->firstBlock[node];
+        for (int k = 0; k < roadmap->degree[node]; k++) {
+            if (k > 0 && k % ROADMAP_EDGE_BLOCK == 0)
+                block = roadmap->blockNext[block];
+            int slot = block * ROADMAP_EDGE_BLOCK + k % ROADMAP_EDGE_BLOCK;
+            roadmap->edgeTargets[numEdgeEnds] = roadmap->blockTargets[slot];
+            roadmap->edgeLengths[numEdgeEnds] = roadmap->blockLengths[slot];
+            roadmap->edgeChecked[numEdgeEnds] = roadmap->blockChecked[slot];
+            numEdgeEnds++;
+        }
+    }
+    roadmap->edgeOffsets[roadmap->size] = numEdgeEnds;
+    freeRoadmapBlocks(roadmap);
+    roadmap->compacted = 1;
+}
 
-    clock_t start = clock();
+// Grows the arrays of roadmap that are indexed by node to hold capacity nodes
+static void reserveRoadmapNodes(Roadmap* roadmap, int capacity) {
+    if (capacity <= roadmap->capacity)
+        return;
+    roadmap->capacity = capacity;
+    roadmap->joints = (double**) realloc(roadmap->joints, roadmap->capacity * sizeof(double*));
+    roadmap->degree = (int*) realloc(roadmap->degree, roadmap->capacity * sizeof(int));
+    roadmap->component = (int*) realloc(roadmap->component, roadmap->capacity * sizeof(int));
+    roadmap->componentRank = (int*) realloc(roadmap->componentRank, roadmap->capacity * sizeof(int));
+    roadmap->pathParent = (int*) realloc(roadmap->pathParent, roadmap->capacity * sizeof(int));
+    roadmap->nodeNum = (int*) realloc(roadmap->nodeNum, roadmap->capacity * sizeof(int));
+    roadmap->firstBlock = (int*) realloc(roadmap->firstBlock, roadmap->capacity * sizeof(int));
+    roadmap->overlayAdjacent = (unsigned char*) realloc(roadmap->overlayAdjacent, roadmap->capacity);
+    roadmap->edgeOffsets = (int*) realloc(roadmap->edgeOffsets, (roadmap->capacity + 1) * sizeof(int));
+}
 
-	//no plan by default
-	*plan = NULL;
-	*planlength = 0;
+// Adds a node without edges at joint, which must outlive roadmap, and returns its id
+static int addRoadmapNode(Roadmap* roadmap, double* joint) {
+    expandRoadmap(roadmap);
+    if (roadmap->size == roadmap->capacity)
+        reserveRoadmapNodes(roadmap, 2 * roadmap->capacity);
+    int node = roadmap->size++;
+    roadmap->joints[node] = joint;
+    roadmap->degree[node] = 0;
+    roadmap->component[node] = node;
+    roadmap->componentRank[node] = 0;
+    roadmap->pathParent[node] = -1;
+    roadmap->nodeNum[node] = -1;
+    roadmap->firstBlock[node] = -1;
+    roadmap->overlayAdjacent[node] = 0;
+    return node;
+}
 
-    int discretizationFactor = getAngleDiscretizationFactor(numofDOFs);
-    double discretizationStep = (2 * PI)/discretizationFactor;
-    double epsilon = PI/4;
-    //printf("Discretization factor is %d and epsilon is %f\n", discretizationFactor, epsilon);
+// Adds an edge of length between node and otherNode; checked tells whether it
+// is already known to be collision free
+static void addRoadmapEdge(Roadmap* roadmap, int node, int otherNode, double length, int checked) {
+    expandRoadmap(roadmap);
+    addRoadmapEdgeEnd(roadmap, node, otherNode, length, checked);
+    addRoadmapEdgeEnd(roadmap, otherNode, node, length, checked);
+    roadmap->numEdges++;
+    joinRoadmapComponents(roadmap, node, otherNode);
+}
 
-	Node* startNode = (Node*) malloc(sizeof(Node));
-    double* startJoint = (double*) malloc(numofDOFs * sizeof(double));
-    for (int i = 0; i < numofDOFs; i++) {
-        startJoint[i] = armstart_anglesV_rad[i];
+// Adds an edge of length between overlay node i and node, which is either a
+// node of the roadmap or size + j for overlay node j
+static void addRoadmapOverlayEdge(Roadmap* roadmap, int i, int node, double length, int checked) {
+    if (roadmap->numOverlayEdges == roadmap->overlayEdgeCapacity) {
+        roadmap->overlayEdgeCapacity = MAX(2 * roadmap->overlayEdgeCapacity, 64);
+        roadmap->overlayEdgeNodes = (int*) realloc(roadmap->overlayEdgeNodes, roadmap->overlayEdgeCapacity * sizeof(int));
+        roadmap->overlayEdgeTargets = (int*) realloc(roadmap->overlayEdgeTargets, roadmap->overlayEdgeCapacity * sizeof(int));
+        roadmap->overlayEdgeLengths = (float*) realloc(roadmap->overlayEdgeLengths, roadmap->overlayEdgeCapacity * sizeof(float));
+        roadmap->overlayEdgeChecked = (unsigned char*) realloc(roadmap->overlayEdgeChecked, roadmap->overlayEdgeCapacity);
     }
-    startNode->joint = startJoint;
-    startNode->parent = 0;
-    startNode->nodeNum = 1;
-    vector<Node*>* startTree = new vector<Node*>();
-    startTree->push_back(startNode);
-    //printf("Created startTree and added startNode to it.\n");
+    int e = roadmap->numOverlayEdges++;
+    roadmap->overlayEdgeNodes[e] = i;
+    roadmap->overlayEdgeTargets[e] = (node < roadmap->size) ? node : roadmap->size - 1 - node;
+    roadmap->overlayEdgeLengths[e] = length;
+    roadmap->overlayEdgeChecked[e] = checked;
+    if (node < roadmap->size)
+        roadmap->overlayAdjacent[node] = 1;
+}
 
-    Node* goalNode = (Node*) malloc(sizeof(Node));
-    double* goalJoint = (double*) malloc(numofDOFs * sizeof(double));
-    for (int i = 0; i < numofDOFs; i++) {
-        goalJoint[i] = armgoal_anglesV_rad[i];
+// Returns the node across overlay edge e from node, -1 if e does not end at node.
+// The ids of the overlay nodes follow the size the roadmap has at the time.
+static inline int getRoadmapOverlayNeighbor(Roadmap* roadmap, int e, int node) {
+    int overlayNode = roadmap->size + roadmap->overlayEdgeNodes[e];
+    int target = roadmap->overlayEdgeTargets[e];
+    if (target < 0)
+        target = roadmap->size - 1 - target;
+    if (node == overlayNode)
+        return target;
+    return (node == target) ? overlayNode : -1;
+}
+
+// Returns the overlay edge between node and otherNode, -1 if there is none
+static int findRoadmapOverlayEdge(Roadmap* roadmap, int node, int otherNode) {
+    for (int e = 0; e < roadmap->numOverlayEdges; e++) {
+        if (getRoadmapOverlayNeighbor(roadmap, e, node) == otherNode)
+            return e;
     }
-    goalNode->joint = armgoal_anglesV_rad;
-    goalNode->parent = 0;
-    goalNode->nodeNum = 1;
-    vector<Node*>* goalTree = new vector<Node*>();
-    goalTree->push_back(goalNode);
-    //printf("Created goalTree and added goalNode to it.\n");
+    return -1;
+}
 
-    vector<Node*>*  currTree = startTree;
-    double* currJoint;
-    Node* closestNeighbor;
-    int isStartTree = 1;
-    while (1) {
-        if (((clock() - start ) / (double) CLOCKS_PER_SEC) > TIMELIMIT) {
-            ExperimentResult result;
-            result.planningTime = -1;
-            return result;
+// Whether overlay nodes 0 and 1 are joined, by an edge of their own or through
+// a component of the roadmap both have edges into
+static int roadmapOverlayConnected(Roadmap* roadmap) {
+    for (int e = 0; e < roadmap->numOverlayEdges; e++) {
+        if (roadmap->overlayEdgeTargets[e] < 0)
+            return 1;
+    }
+    for (int e = 0; e < roadmap->numOverlayEdges; e++) {
+        if (roadmap->overlayEdgeNodes[e] != 0)
+            continue;
+        int root = findRoadmapComponent(roadmap, roadmap->overlayEdgeTargets[e]);
+        for (int f = 0; f < roadmap->numOverlayEdges; f++) {
+            if (roadmap->overlayEdgeNodes[f] == 1 && findRoadmapComponent(roadmap, roadmap->overlayEdgeTargets[f]) == root)
+                return 1;
         }
-        /*if (isStartTree)
-            printf("Start tree iteration!\n");
-        else
-            printf("Goal tree iteration!\n");*/
+    }
+    return 0;
+}
 
-        currJoint = (double*) malloc(numofDOFs * sizeof(double));
-        for (int i = 0; i < numofDOFs; i++) {
-            currJoint[i] = (2 * PI ) * (((double)(rand() % discretizationFactor))/discretizationFactor);
+// Gives the overlay nodes the ids past the last node of the roadmap for a search
+static void placeRoadmapOverlay(Roadmap* roadmap) {
+    reserveRoadmapNodes(roadmap, roadmap->size + roadmap->numOverlayNodes);
+    for (int i = 0; i < roadmap->numOverlayNodes; i++) {
+        roadmap->joints[roadmap->size + i] = roadmap->overlayJoints[i];
+        roadmap->nodeNum[roadmap->size + i] = -1;
+    }
+}
+
+// Detaches the overlay nodes and their edges, leaving the roadmap as it was
+// before the query apart from the samples it added
+static void clearRoadmapOverlay(Roadmap* roadmap) {
+    for (int e = 0; e < roadmap->numOverlayEdges; e++) {
+        if (roadmap->overlayEdgeTargets[e] >= 0)
+            roadmap->overlayAdjacent[roadmap->overlayEdgeTargets[e]] = 0;
+    }
+    roadmap->numOverlayEdges = 0;
+    roadmap->numOverlayNodes = 0;
+}
+
+// Removes target from the edges of node, keeping the others in order.  The
+// emptied slot at the end of the chain is reused by the next edge of node.
+static void removeRoadmapEdgeEnd(Roadmap* roadmap, int node, int target) {
+    int block = roadmap->firstBlock[node];
+    int previousSlot = -1;
+    int removed = 0;
+    for (int k = 0; k < roadmap->degree[node]; k++) {
+        if (k > 0 && k % ROADMAP_EDGE_BLOCK == 0)
+            block = roadmap->blockNext[block];
+        int slot = block * ROADMAP_EDGE_BLOCK + k % ROADMAP_EDGE_BLOCK;
+        if (removed) {
+            roadmap->blockTargets[previousSlot] = roadmap->blockTargets[slot];
+            roadmap->blockLengths[previousSlot] = roadmap->blockLengths[slot];
+            roadmap->blockChecked[previousSlot] = roadmap->blockChecked[slot];
+        } else if (roadmap->blockTargets[slot] == target) {
+            removed = 1;
         }
-        if(!IsValidArmConfiguration(currJoint, numofDOFs, worldMap, x_size, y_size))
-            continue;
-        //printf("currJoint = [%f, %f, %f, %f, %f]\n",
-        //	currJoint[0], currJoint[1], currJoint[2], currJoint[3], currJoint[4]);
-        double closestNeighborDistance = getClosestNeighborFromTree(currJoint, currTree, numofDOFs, &closestNeighbor);
+        previousSlot = slot;
+    }
+    if (removed)
+        roadmap->degree[node]--;
+}
 
-        //printf("closestNeighbor to currJoint is %f away = [%f, %f, %f, %f, %f]\n", closestNeighborDistance,
-        //        closestNeighbor->joint[0], closestNeighbor->joint[1], closestNeighbor->joint[2],
-        //        closestNeighbor->joint[3], closestNeighbor->joint[4]);
+static void removeRoadmapEdge(Roadmap* roadmap, int node, int otherNode) {
+    if (node >= roadmap->size || otherNode >= roadmap->size) {
+        int e = findRoadmapOverlayEdge(roadmap, node, otherNode);
+        int last = --roadmap->numOverlayEdges;
+        roadmap->overlayEdgeNodes[e] = roadmap->overlayEdgeNodes[last];
+        roadmap->overlayEdgeTargets[e] = roadmap->overlayEdgeTargets[last];
+        roadmap->overlayEdgeLengths[e] = roadmap->overlayEdgeLengths[last];
+        roadmap->overlayEdgeChecked[e] = roadmap->overlayEdgeChecked[last];
+        return;
+    }
+    expandRoadmap(roadmap);
+    removeRoadmapEdgeEnd(roadmap, node, otherNode);
+    removeRoadmapEdgeEnd(roadmap, otherNode, node);
+    roadmap->numEdges--;
+}
 
-        if (closestNeighborDistance > epsilon) {
-            for (int j = 0; j < numofDOFs; j++) {
-                currJoint[j] = closestNeighbor->joint[j] + epsilon * ((currJoint[j] - closestNeighbor->joint[j])/closestNeighborDistance);
+// Returns where the checked flag of the edge from node to target is kept, in
+// the overlay edges, the CSR arrays or the blocks, whichever holds it
+static unsigned char* getRoadmapEdgeChecked(Roadmap* roadmap, int node, int target) {
+    if (node >= roadmap->size || target >= roadmap->size) {
+        int e = findRoadmapOverlayEdge(roadmap, node, target);
+        return (e == -1) ? 0 : &roadmap->overlayEdgeChecked[e];
+    }
+    if (roadmap->compacted) {
+        for (int e = roadmap->edgeOffsets[node]; e < roadmap->edgeOffsets[node + 1]; e++) {
+            if (roadmap->edgeTargets[e] == target)
+                return &roadmap->edgeChecked[e];
+        }
+        return 0;
+    }
+    int block = roadmap->firstBlock[node];
+    for (int k = 0; k < roadmap->degree[node]; k++) {
+        if (k > 0 && k % ROADMAP_EDGE_BLOCK == 0)
+            block = roadmap->blockNext[block];
+        int slot = block * ROADMAP_EDGE_BLOCK + k % ROADMAP_EDGE_BLOCK;
+        if (roadmap->blockTargets[slot] == target)
+            return &roadmap->blockChecked[slot];
+    }
+    return 0;
+}
+
+static void getNearRoadmapNodes(double* joint, Roadmap* roadmap, NNIndex* index, vector<int>* nearNodes, vector<double>* nearNodeDistances, double radius, int numofDOFs) {
+    clock_t queryStart = clock();
+    if (NN_BACKEND != NN_LINEAR) {
+        nnIndexRadius(index, joint, radius, nearNodes, nearNodeDistances);
+        recordNNQuery(index, queryStart);
+        return;
+    }
+    radius = pow(radius, 2);
+    for (int i = 0; i < roadmap->size; i++) {
+        double* neighborJoint = getRoadmapJoint(roadmap, i);
+        double currNeighborDistance = 0;
+        for (int j = 0; j < numofDOFs; j++) {
+            currNeighborDistance += pow(fabs(neighborJoint[j] - joint[j]), 2);
+        }
+
+        if (currNeighborDistance <= radius) {
+            nearNodes->push_back(i);
+            nearNodeDistances->push_back(sqrt(currNeighborDistance));
+        }
+    }
+    recordNNQuery(index, queryStart);
+}
+
+// k of k-PRM*, e(1 + 1/d) log n, the fewest nearest neighbors that keep the
+// roadmap asymptotically optimal
+static int getPRMStarK(int numVertices, int numofDOFs) {
+    // at least one neighbour, also while the roadmap holds a single node or none
+    return MAX(1, (int) ceil(exp(1.0) * (1 + 1.0 / numofDOFs) * log(MAX(numVertices, 2))));
+}
+
+// Appends the (at most) k nodes closest to joint, closest first
+static void findKNearestRoadmapNodes(double* joint, Roadmap* roadmap, NNIndex* index, int k, vector<int>* nearNodes, vector<double>* nearNodeDistances, int numofDOFs) {
+    if (roadmap->size == 0 || k <= 0)
+        return;
+    if (NN_BACKEND != NN_LINEAR) {
+        nnIndexKNearest(index, joint, k, nearNodes, nearNodeDistances);
+        return;
+    }
+    vector<pair<double, int> > nearest;
+    for (int i = 0; i < roadmap->size; i++) {
+        double* neighborJoint = getRoadmapJoint(roadmap, i);
+        double currNeighborDistance = 0;
+        for (int j = 0; j < numofDOFs; j++) {
+            currNeighborDistance += pow(fabs(neighborJoint[j] - joint[j]), 2);
+        }
+        nearest.push_back(make_pair(currNeighborDistance, i));
+    }
+    k = MIN(k, (int) nearest.size());
+    partial_sort(nearest.begin(), nearest.begin() + k, nearest.end());
+    for (int i = 0; i < k; i++) {
+        nearNodes->push_back(nearest[i].second);
+        nearNodeDistances->push_back(sqrt(nearest[i].first));
+    }
+}
+
+// Appends the k nodes closest to joint.  With symmetric set, only the ones that
+// would also have joint among their own k nearest nodes and have fewer than k
+// edges are kept, so no node ends up with more than k edges.
+static void getKNearestRoadmapNodes(double* joint, Roadmap* roadmap, NNIndex* index, vector<int>* nearNodes, vector<double>* nearNodeDistances, int k, int symmetric, int numofDOFs) {
+    clock_t queryStart = clock();
+    findKNearestRoadmapNodes(joint, roadmap, index, k, nearNodes, nearNodeDistances, numofDOFs);
+    if (symmetric) {
+        vector<int> ids;
+        vector<double> distances;
+        int numKept = 0;
+        for (int i = 0; i < nearNodes->size(); i++) {
+            int neighbor = (*nearNodes)[i];
+            if (roadmap->degree[neighbor] >= k)
+                continue;
+            ids.clear();
+            distances.clear();
+            // the closest of these is neighbor itself
+            findKNearestRoadmapNodes(getRoadmapJoint(roadmap, neighbor), roadmap, index, k + 1, &ids, &distances, numofDOFs);
+            if (ids.size() <= k || (*nearNodeDistances)[i] <= distances.back()) {
+                (*nearNodes)[numKept] = neighbor;
+                (*nearNodeDistances)[numKept] = (*nearNodeDistances)[i];
+                numKept++;
             }
-            closestNeighborDistance = epsilon;
         }
-        int jointTransitionValid = isJointTransitionValid(closestNeighborDistance, discretizationStep, numofDOFs,
-                currJoint, closestNeighbor->joint, worldMap, x_size, y_size);
-        // printf("currJoint to neighborJoint valid = %d\n", jointTransitionValid);
+        nearNodes->resize(numKept);
+        nearNodeDistances->resize(numKept);
+    }
+    recordNNQuery(index, queryStart);
+}
 
-        Node* currNode;
-        if (jointTransitionValid) {
-            currNode = (Node*) malloc(sizeof(Node));
-            currNode->joint = currJoint;
-            currNode->parent = closestNeighbor;
-            currNode->nodeNum = closestNeighbor->nodeNum + 1;
-            currTree->push_back(currNode);
-            // printf("currJoint was valid, so added it to lists -- there are now %d nodes.\n",  currTree->size());
+// Recomputes the components from scratch, since the disjoint-set forest cannot
+// split them again after removeRoadmapEdge
+static void rebuildRoadmapComponents(Roadmap* roadmap) {
+    compactRoadmap(roadmap);
+    for (int node = 0; node < roadmap->size; node++) {
+        roadmap->component[node] = node;
+        roadmap->componentRank[node] = 0;
+    }
+    for (int node = 0; node < roadmap->size; node++) {
+        for (int e = roadmap->edgeOffsets[node]; e < roadmap->edgeOffsets[node + 1]; e++) {
+            joinRoadmapComponents(roadmap, node, roadmap->edgeTargets[e]);
         }
-        
-        if (isStartTree) {
-            currTree = goalTree;
-            isStartTree = 0;
-        } else {
-            currTree = startTree;
-            isStartTree = 1;
+    }
+}
+
+// Readies the search scratch of roadmap for node ids below numNodes.  Only the
+// nodes the previous search reached are reset, so that searches which stay
+// local, like those of the sparse roadmap, don't pay for the whole roadmap.
+static void prepareRoadmapSearch(Roadmap* roadmap, int numNodes) {
+    if (numNodes > roadmap->searchCapacity) {
+        roadmap->searchCapacity = MAX(numNodes, 2 * roadmap->searchCapacity);
+        free(roadmap->searchCost);
+        free(roadmap->searchClosed);
+        free(roadmap->searchReached);
+        if (roadmap->searchHeap != 0)
+            freeIndexedHeap(roadmap->searchHeap);
+        roadmap->searchCost = (double*) malloc(roadmap->searchCapacity * sizeof(double));
+        roadmap->searchClosed = (unsigned char*) calloc(roadmap->searchCapacity, 1);
+        roadmap->searchReached = (int*) malloc(roadmap->searchCapacity * sizeof(int));
+        roadmap->searchHeap = createIndexedHeap(roadmap->searchCapacity);
+        for (int i = 0; i < numNodes; i++) {
+            roadmap->nodeNum[i] = -1;
         }
-        //printf("Swapped trees. isStartTree = %d\n",  isStartTree);
-        
-        if (jointTransitionValid) {
-            
-            // Calculate closest neighbor
-            closestNeighborDistance = getClosestNeighborFromTree(currJoint, currTree, numofDOFs, &closestNeighbor);
-            //printf("closestNeighbor to currJoint is %f away = [%f, %f, %f, %f, %f]\n", closestNeighborDistance,
-            //    closestNeighbor->joint[0], closestNeighbor->joint[1], closestNeighbor->joint[2],
-            //    closestNeighbor->joint[3], closestNeighbor->joint[4]);
+        roadmap->numSearchReached = 0;
+        return;
+    }
+    for (int i = 0; i < roadmap->numSearchReached; i++) {
+        int node = roadmap->searchReached[i];
+        roadmap->nodeNum[node] = -1;
+        roadmap->searchClosed[node] = 0;
+    }
+    roadmap->numSearchReached = 0;
+    IndexedHeap* heap = roadmap->searchHeap;
+    for (int i = 0; i < heap->size; i++) {
+        heap->positions[heap->nodes[i]] = -1;
+    }
+    heap->size = 0;
+}
 
-            double* otherJoint;
-            while (closestNeighborDistance > epsilon) {
-                otherJoint = (double*) malloc(numofDOFs * sizeof(double));
-                for (int j = 0; j < numofDOFs; j++) {
-                    otherJoint[j] = closestNeighbor->joint[j] + epsilon * ((currJoint[j] - closestNeighbor->joint[j])/closestNeighborDistance);
-                }
-                //printf("otherJoint = [%f, %f, %f, %f, %f]\n",
-                //    otherJoint[0], otherJoint[1], otherJoint[2], otherJoint[3], otherJoint[4]);
-                int jointTransitionValid = isJointTransitionValid(epsilon, discretizationStep, numofDOFs,
-                    otherJoint, closestNeighbor->joint, worldMap, x_size, y_size);
-                //printf("otherJoint to neighborJoint valid = %d\n", jointTransitionValid);
+// Records that the search reached node from parent (-1 for the start)
+static inline void reachRoadmapNode(Roadmap* roadmap, int node, int parent) {
+    if (roadmap->nodeNum[node] == -1)
+        roadmap->searchReached[roadmap->numSearchReached++] = node;
+    roadmap->pathParent[node] = parent;
+    roadmap->nodeNum[node] = (parent == -1) ? 1 : roadmap->nodeNum[parent] + 1;
+}
 
-                if (jointTransitionValid) {
-                    Node* otherNode = (Node*) malloc(sizeof(Node));
-                    otherNode->joint = otherJoint;
-                    otherNode->parent = closestNeighbor;
-                    otherNode->nodeNum = closestNeighbor->nodeNum + 1;
-                    currTree->push_back(otherNode);
-                    closestNeighbor = otherNode;
-                    closestNeighborDistance -= epsilon;
-                } else {
-                    break;
+static int searchRoadmapBFS(Roadmap* roadmap, int startNode, int goalNode) {
+    prepareRoadmapSearch(roadmap, roadmap->size + roadmap->numOverlayNodes);
+    reachRoadmapNode(roadmap, startNode, -1);
+
+    queue<int> prmQueue;
+    prmQueue.push(startNode);
+
+    while(prmQueue.size() != 0) {
+        int currNode = prmQueue.front();
+        prmQueue.pop();
+        roadmap->numExpansions++;
+        if (currNode == goalNode) {
+            //printf("Found path to goalNode!\n");
+            return 1;
+        }
+        if (currNode >= roadmap->size || roadmap->overlayAdjacent[currNode]) {
+            for (int e = 0; e < roadmap->numOverlayEdges; e++) {
+                int neighbor = getRoadmapOverlayNeighbor(roadmap, e, currNode);
+                if (neighbor != -1 && roadmap->nodeNum[neighbor] == -1) {
+                    reachRoadmapNode(roadmap, neighbor, currNode);
+                    prmQueue.push(neighbor);
                 }
             }
+        }
+        if (currNode >= roadmap->size)
+            continue;
+        for (int e = roadmap->edgeOffsets[currNode]; e < roadmap->edgeOffsets[currNode + 1]; e++) {
+            int neighbor = roadmap->edgeTargets[e];
+            if (roadmap->nodeNum[neighbor] == -1) {
+                reachRoadmapNode(roadmap, neighbor, currNode);
+                prmQueue.push(neighbor);
+            }
+        }
+    }
+    return 0;
+}
 
-            if (closestNeighborDistance <= epsilon) {
-                Node* startTreeNode;
-                Node* goalTreeNode;
-                if (isStartTree) {
-                    startTreeNode = closestNeighbor;
-                    goalTreeNode = currNode;
-                } else {
-                    startTreeNode = currNode;
-                    goalTreeNode = closestNeighbor;
-                }
-                int startTreeLength = startTreeNode->nodeNum;
-                int goalTreeLength = goalTreeNode->nodeNum;
-                //printf("Connect succeeded!\n");
-                *planlength = startTreeLength + goalTreeLength;
-                *plan = (double**) malloc(*planlength * sizeof(double*));
+// Lowers the cost of neighbor to that of the way from currNode along an edge
+// of length, if that is cheaper, and queues it for searchRoadmapAStar
+template <int DOF>
+static inline void relaxRoadmapEdge(Roadmap* roadmap, int currNode, int neighbor, float length,
+        double* goalJoint, int useHeuristic) {
+    if (roadmap->searchClosed[neighbor])
+        return;
+    double cost = roadmap->searchCost[currNode] + length;
+    if (roadmap->nodeNum[neighbor] != -1 && cost >= roadmap->searchCost[neighbor])
+        return;
+    roadmap->searchCost[neighbor] = cost;
+    reachRoadmapNode(roadmap, neighbor, currNode);
+    double heuristic = useHeuristic ?
+            getJointDistance<DOF>(getRoadmapJoint(roadmap, neighbor), goalJoint, roadmap->numofDOFs) : 0;
+    indexedHeapPush(roadmap->searchHeap, neighbor, cost + heuristic);
+}
 
-                // printf("Start side has %d nodes\n", startTreeLength);
-                for (int i = startTreeLength - 1; i >= 0; i--) {
-                    (*plan)[i] = (double*) malloc(numofDOFs * sizeof(double));
-                    for(int j = 0; j < numofDOFs; j++){
-                        (*plan)[i][j] = startTreeNode->joint[j];
-                    }
-                    startTreeNode = startTreeNode->parent;
-                }
+// Shortest path search over the edge lengths, ordered by the cost so far plus
+// (with useHeuristic) the joint space distance left to goalNode, which never
+// overestimates the rest of the path.  Gives up once every path left would
+// cost more than maxCost.  Reads the edges from the CSR arrays or the blocks,
+// whichever the roadmap is in, so it does not need compactRoadmap.  The
+// overlay edges are only followed with useOverlay.
+template <int DOF>
+static int searchRoadmapAStar(Roadmap* roadmap, int startNode, int goalNode, int useHeuristic, int useOverlay, double maxCost) {
+    double* goalJoint = getRoadmapJoint(roadmap, goalNode);
+    prepareRoadmapSearch(roadmap, roadmap->size + (useOverlay ? roadmap->numOverlayNodes : 0));
+    IndexedHeap* heap = roadmap->searchHeap;
+    reachRoadmapNode(roadmap, startNode, -1);
+    roadmap->searchCost[startNode] = 0;
+    indexedHeapPush(heap, startNode, 0);
 
-                // printf("Goal side has %d nodes\n", goalTreeNode->nodeNum);
-                for (int i = 0; i < goalTreeLength; i++) {
-                    (*plan)[i + startTreeLength] = (double*) malloc(numofDOFs * sizeof(double));
-                    for(int j = 0; j < numofDOFs; j++){
-                        (*plan)[i + startTreeLength][j] = goalTreeNode->joint[j];
-                    }
-                    goalTreeNode = goalTreeNode->parent;
-                }
-                /*for (int i = 0; i < *planlength; i++) {
-                    printf("Plan step %d = [%f, %f, %f, %f, %f]\n", i, (*plan)[i][0], (*plan)[i][1], (*plan)[i][2],
-                            (*plan)[i][3], (*plan)[i][4]);
-                }*/
-                ExperimentResult result;
-                result.planningTime = (clock() - start ) / (double) CLOCKS_PER_SEC;
-                result.numNodes = startTree->size() + goalTree->size();
-                result.planLength = *planlength;
-                result.planQuality = getPlanQuality(plan, planlength, numofDOFs);
-                for(int i = 0; i < startTree->size(); i++) {
-                    free((*startTree)[i]->joint);
-                    free((*startTree)[i]);
-                }
-                for(int i = 0; i < goalTree->size(); i++) {
-                    free((*goalTree)[i]->joint);
-                    free((*goalTree)[i]);
-                }
-                //printf("Path has %d nodes and %d total nodes were generated in %f seconds with planQuality %f.\n", result.planLength, result.numNodes, result.planningTime, result.planQuality);
-                return result;
+    while (heap->size > 0 && heap->keys[0] <= maxCost) {
+        int currNode = indexedHeapPop(heap);
+        roadmap->numExpansions++;
+        if (currNode == goalNode)
+            return 1;
+        roadmap->searchClosed[currNode] = 1;
+        if (useOverlay && (currNode >= roadmap->size || roadmap->overlayAdjacent[currNode])) {
+            for (int e = 0; e < roadmap->numOverlayEdges; e++) {
+                int neighbor = getRoadmapOverlayNeighbor(roadmap, e, currNode);
+                if (neighbor != -1)
+                    relaxRoadmapEdge<DOF>(roadmap, currNode, neighbor, roadmap->overlayEdgeLengths[e], goalJoint, useHeuristic);
+            }
+        }
+        if (currNode >= roadmap->size)
+            continue;
+        if (roadmap->compacted) {
+            for (int e = roadmap->edgeOffsets[currNode]; e < roadmap->edgeOffsets[currNode + 1]; e++) {
+                relaxRoadmapEdge<DOF>(roadmap, currNode, roadmap->edgeTargets[e], roadmap->edgeLengths[e], goalJoint, useHeuristic);
             }
+            continue;
+        }
+        int block = roadmap->firstBlock[currNode];
+        for (int k = 0; k < roadmap->degree[currNode]; k++) {
+            if (k > 0 && k % ROADMAP_EDGE_BLOCK == 0)
+                block = roadmap->blockNext[block];
+            int slot = block * ROADMAP_EDGE_BLOCK + k % ROADMAP_EDGE_BLOCK;
+            relaxRoadmapEdge<DOF>(roadmap, currNode, roadmap->blockTargets[slot], roadmap->blockLengths[slot], goalJoint, useHeuristic);
+        }
+    }
+    return 0;
+}
+
+// Looks for a path from startNode to goalNode with the search PRM_SEARCH
+// selects, leaving it in pathParent and the number of nodes on it in nodeNum.
+// Either may be an overlay node.  Returns whether goalNode was reached.
+template <int DOF>
+static int searchRoadmap(Roadmap* roadmap, int startNode, int goalNode) {
+    clock_t searchStart = clock();
+    compactRoadmap(roadmap);
+    placeRoadmapOverlay(roadmap);
+    int found;
+    if (PRM_SEARCH == PRM_SEARCH_BFS)
+        found = searchRoadmapBFS(roadmap, startNode, goalNode);
+    else
+        found = searchRoadmapAStar<DOF>(roadmap, startNode, goalNode, PRM_SEARCH == PRM_SEARCH_ASTAR, 1, DT_INFINITY);
+    roadmap->searchTime += (clock() - searchStart) / (double) CLOCKS_PER_SEC;
+    return found;
+}
+
+// Lazily checks the edges on the path found by searchRoadmap that were not
+// checked by an earlier call, marking the valid ones and removing the colliding
+// ones from the roadmap.  Returns whether the whole path is valid.
+template <int DOF>
+static int validateRoadmapPath(Roadmap* roadmap, int goalNode, double discretizationStep, int dynamicDOFs, WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    int pathValid = 1;
+    for (int node = goalNode; roadmap->nodeNum[node] != 1; ) {
+        int nextNode = roadmap->pathParent[node];
+        if (*getRoadmapEdgeChecked(roadmap, node, nextNode)) {
+            roadmap->numPathEdgesReused++;
+            node = nextNode;
+            continue;
         }
+        double* joint = getRoadmapJoint(roadmap, node);
+        double* nextJoint = getRoadmapJoint(roadmap, nextNode);
+        double distance = getJointDistance<DOF>(joint, nextJoint, numofDOFs);
+        roadmap->numPathEdgesChecked++;
+        if (isJointTransitionValid<DOF>(distance, discretizationStep, numofDOFs, joint, nextJoint, worldMap)) {
+            *getRoadmapEdgeChecked(roadmap, node, nextNode) = 1;
+            *getRoadmapEdgeChecked(roadmap, nextNode, node) = 1;
+        } else {
+            removeRoadmapEdge(roadmap, node, nextNode);
+            roadmap->numPathEdgesCut++;
+            pathValid = 0;
+        }
+        node = nextNode;
     }
+    return pathValid;
 }
 
-static double getRRTStarRadius(int numVertices, int numofDOFs, double epsilon) {
-    double calcRad = pow((1000 * log(numVertices)/numVertices), (1.0/numofDOFs));
-    return min(calcRad, epsilon);
+// Whether roadmap has a path from node to otherNode no longer than maxCost,
+// without going through the overlay nodes
+template <int DOF>
+static int roadmapPathWithin(Roadmap* roadmap, int node, int otherNode, double maxCost) {
+    return searchRoadmapAStar<DOF>(roadmap, node, otherNode, 1, 0, maxCost);
 }
 
-static ExperimentResult plannerRRTStar(double* worldMap, int x_size, int y_size,
-        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int numofDOFs,
-        double*** plan, int* planlength) {
+// Gives node, at joint, edges to the overlay nodes within maxDistance of it,
+// checked with checkEdges, so that the samples a query adds reach its start
+// and goal the way they reach the nodes of the roadmap
+template <int DOF>
+static void connectRoadmapOverlay(double* joint, int node, Roadmap* roadmap, double maxDistance, int checkEdges,
+        double discretizationStep, int dynamicDOFs, WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    for (int i = 0; i < roadmap->numOverlayNodes; i++) {
+        double* overlayJoint = roadmap->overlayJoints[i];
+        double distance = getJointDistance<DOF>(joint, overlayJoint, numofDOFs);
+        if (distance > maxDistance)
+            continue;
+        if (checkEdges && !isJointTransitionValid<DOF>(distance, discretizationStep, numofDOFs, joint, overlayJoint, worldMap))
+            continue;
+        addRoadmapOverlayEdge(roadmap, i, node, distance, checkEdges);
+    }
+}
 
-    clock_t start = clock();
+// Adds joint to the sparse roadmap if it is needed there: when no node within
+// visibilityRadius sees it (coverage), when the nodes it sees lie in different
+// components (connectivity), or when two of them have no path through the
+// roadmap within SPARSE_STRETCH_FACTOR times the way through joint (quality).
+// It gets edges to the nodes it sees that the roadmap cannot already reach
+// within the stretch factor.  Returns the new node, or -1 if joint is not needed.
+template <int DOF>
+static int addSparseRoadmapSample(double* joint, Roadmap* roadmap, NNIndex* index, vector<int>* nearNodes, vector<double>* nearNodeDistances,
+        double visibilityRadius, double discretizationStep, int dynamicDOFs, WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    nearNodes->clear();
+    nearNodeDistances->clear();
+    getKNearestRoadmapNodes(joint, roadmap, index, nearNodes, nearNodeDistances, getPRMStarK(roadmap->size, numofDOFs), 0, numofDOFs);
+    int numVisible = 0;
+    for (int i = 0; i < nearNodes->size() && (*nearNodeDistances)[i] <= visibilityRadius; i++) {
+        int neighbor = (*nearNodes)[i];
+        double neighborDistance = (*nearNodeDistances)[i];
+        if (!isJointTransitionValid<DOF>(neighborDistance, discretizationStep, numofDOFs, joint, getRoadmapJoint(roadmap, neighbor), worldMap))
+            continue;
+        (*nearNodes)[numVisible] = neighbor;
+        (*nearNodeDistances)[numVisible] = neighborDistance;
+        numVisible++;
+    }
 
-	//no plan by default
-	*plan = NULL;
-	*planlength = 0;
+    int* reason = 0;
+    if (numVisible == 0)
+        reason = &roadmap->numCoverageNodes;
+    for (int i = 1; i < numVisible && !reason; i++) {
+        if (!roadmapNodesConnected(roadmap, (*nearNodes)[0], (*nearNodes)[i]))
+            reason = &roadmap->numConnectivityNodes;
+    }
+    for (int i = 0; i < numVisible && !reason; i++) {
+        for (int j = i + 1; j < numVisible && !reason; j++) {
+            double throughJoint = (*nearNodeDistances)[i] + (*nearNodeDistances)[j];
+            if (!roadmapPathWithin<DOF>(roadmap, (*nearNodes)[i], (*nearNodes)[j], SPARSE_STRETCH_FACTOR * throughJoint))
+                reason = &roadmap->numQualityNodes;
+        }
+    }
+    if (!reason) {
+        roadmap->numSamplesRejected++;
+        return -1;
+    }
+    (*reason)++;
 
-    int discretizationFactor = getAngleDiscretizationFactor(numofDOFs);
-    double discretizationStep = (2 * PI)/discretizationFactor;
-    double epsilon = PI/4;
+    int node = addRoadmapNode(roadmap, joint);
+    nnIndexAdd(index, joint);
+    for (int i = 0; i < numVisible; i++) {
+        int neighbor = (*nearNodes)[i];
+        double neighborDistance = (*nearNodeDistances)[i];
+        if (!roadmapPathWithin<DOF>(roadmap, node, neighbor, SPARSE_STRETCH_FACTOR * neighborDistance))
+            addRoadmapEdge(roadmap, node, neighbor, neighborDistance, 1);
+    }
+    connectRoadmapOverlay<DOF>(joint, node, roadmap, visibilityRadius, 1, discretizationStep, numofDOFs, worldMap);
+    return node;
+}
 
-	Node* startNode = (Node*) malloc(sizeof(Node));
-    double* startJoint = (double*) malloc(numofDOFs * sizeof(double));
-    for (int i = 0; i < numofDOFs; i++) {
-        startJoint[i] = armstart_anglesV_rad[i];
+// Finds the nodes PRM_CONNECTION picks for joint to connect to.  Returns how
+// far from joint an overlay node may be to count as one of them: within the
+// radius, or closer than the farthest of fewer than k neighbours.
+static double findRoadmapSampleNeighbors(double* joint, Roadmap* roadmap, NNIndex* index, vector<int>* nearNodes, vector<double>* nearNodeDistances,
+        double epsilon, int numofDOFs) {
+    nearNodes->clear();
+    nearNodeDistances->clear();
+    if (PRM_CONNECTION == PRM_CONNECT_RADIUS) {
+        double radius = getRRTStarRadius(roadmap->size, numofDOFs, epsilon);
+        getNearRoadmapNodes(joint, roadmap, index, nearNodes, nearNodeDistances, radius, numofDOFs);
+        return radius;
     }
-    startNode->joint = startJoint;
-    startNode->parent = 0;
-    startNode->nodeNum = 1;
-    startNode->cost = 0;
-    vector<Node*>* nodes = new vector<Node*>();
-    nodes->push_back(startNode);
-    //printf("Created startTree and added startNode to it.\n");
+    int k = getPRMStarK(roadmap->size, numofDOFs);
+    getKNearestRoadmapNodes(joint, roadmap, index, nearNodes, nearNodeDistances, k,
+            PRM_CONNECTION == PRM_CONNECT_KNEAREST_SYMMETRIC, numofDOFs);
+    return (nearNodes->size() < k) ? DT_INFINITY : nearNodeDistances->back();
+}
 
-    double* currJoint;
-    Node* closestNeighbor;
-    Node* goalNode;
-    int isGoalJoint = 0;
-    int numAfterGoal = -1;
-    while (1) {
-        if (((clock() - start ) / (double) CLOCKS_PER_SEC) > TIMELIMIT) {
-            ExperimentResult result;
-            result.planningTime = -1;
-            return result;
-        }
-        if (rand() % 2 == 1 && numAfterGoal == -1) {
-            currJoint = (double*) malloc(numofDOFs * sizeof(double));
-            for (int i = 0; i < numofDOFs; i++) {
-                currJoint[i] = armgoal_anglesV_rad[i];
-            }
-            isGoalJoint = 1;
-        } else {
-            currJoint = (double*) malloc(numofDOFs * sizeof(double));
-            generateRandomJoint(&currJoint, numofDOFs);
-            isGoalJoint = 0;
-        }
-        if(!IsValidArmConfiguration(currJoint, numofDOFs, worldMap, x_size, y_size)) {
-            free(currJoint);
-            continue;
-        }
+// Adds joint to the roadmap with edges to the nodes PRM_CONNECTION picks,
+// including overlay nodes, checked unless LAZY_EDGE_VALIDATION defers that.
+// Returns the new node.
+template <int DOF>
+static int connectRoadmapSample(double* joint, Roadmap* roadmap, NNIndex* index, vector<int>* nearNodes, vector<double>* nearNodeDistances,
+        double epsilon, double discretizationStep, int dynamicDOFs, WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double maxDistance = findRoadmapSampleNeighbors(joint, roadmap, index, nearNodes, nearNodeDistances, epsilon, numofDOFs);
+    // printf("Radius = %f, Num nearest nodes = %d, total num nodes = %d\n", radius, nearNodes->size(), roadmap->size);
 
-        // Calculate closest neighbor
-        double radius = getRRTStarRadius(nodes->size(), numofDOFs, epsilon);
-        vector<Node*>* nearNodes = new vector<Node*>();
-        vector<double>* nearNodeDistances = new vector<double>();
+    int node = addRoadmapNode(roadmap, joint);
+    nnIndexAdd(index, joint);
+    // printf("currNode added to roadmap\n");
 
-        double closestNeighborDistance = getClosestNeighborFromTreeAndNearNodes(
-                currJoint, nodes, numofDOFs, &closestNeighbor, nearNodes, nearNodeDistances, radius);
+    for(int i = 0; i < nearNodes->size(); i++) {
+        int neighbor = (*nearNodes)[i];
+        double neighborDistance = (*nearNodeDistances)[i];
+        if(!LAZY_EDGE_VALIDATION && !isJointTransitionValid<DOF>(neighborDistance, discretizationStep, numofDOFs,
+                joint, getRoadmapJoint(roadmap, neighbor), worldMap))
+            continue;
+        addRoadmapEdge(roadmap, neighbor, node, neighborDistance, !LAZY_EDGE_VALIDATION);
+    }
+    connectRoadmapOverlay<DOF>(joint, node, roadmap, maxDistance, !LAZY_EDGE_VALIDATION, discretizationStep, numofDOFs, worldMap);
+    return node;
+}
 
-        //printf("Radius = %f, Num nearest nodes = %d, total num nodes = %d\n", radius, nearNodes->size(), nodes->size());
+// Attaches joint, which must outlive the query, as the next overlay node, with
+// edges to the nodes connectRoadmapSample would pick for it, earlier overlay
+// nodes included.  The overlay stays out of the nearest neighbour index, the
+// components and the CSR arrays, so that clearRoadmapOverlay can drop it again.
+template <int DOF>
+static void addRoadmapOverlayNode(double* joint, Roadmap* roadmap, NNIndex* index, vector<int>* nearNodes, vector<double>* nearNodeDistances,
+        double epsilon, double discretizationStep, int dynamicDOFs, WorldMap* worldMap) {
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
+    double maxDistance = findRoadmapSampleNeighbors(joint, roadmap, index, nearNodes, nearNodeDistances, epsilon, numofDOFs);
+    int overlayNode = roadmap->numOverlayNodes;
+    for (int i = 0; i < nearNodes->size(); i++) {
+        int neighbor = (*nearNodes)[i];
+        double neighborDistance = (*nearNodeDistances)[i];
+        if (!LAZY_EDGE_VALIDATION && !isJointTransitionValid<DOF>(neighborDistance, discretizationStep, numofDOFs,
+                joint, getRoadmapJoint(roadmap, neighbor), worldMap))
+            continue;
+        addRoadmapOverlayEdge(roadmap, overlayNode, neighbor, neighborDistance, !LAZY_EDGE_VALIDATION);
+    }
+    connectRoadmapOverlay<DOF>(joint, roadmap->size + overlayNode, roadmap, maxDistance, !LAZY_EDGE_VALIDATION,
+            discretizationStep, numofDOFs, worldMap);
+    roadmap->overlayJoints[overlayNode] = joint;
+    roadmap->numOverlayNodes++;
+}
 
-        if (closestNeighborDistance > epsilon) {
-            isGoalJoint = 0;
-            for (int j = 0; j < numofDOFs; j++) {
-                currJoint[j] = closestNeighbor->joint[j] + epsilon * ((currJoint[j] - closestNeighbor->joint[j])/closestNeighborDistance);
-            }
-            closestNeighborDistance = epsilon;
-            //printf("Distance was greater than epsilon(%f), so updated currJoint to [%f, %f, %f, %f, %f]\n",
-            //        epsilon, currJoint[0], currJoint[1], currJoint[2], currJoint[3], currJoint[4]);
-        }
+// Header of a roadmap file.  It is followed by these arrays, each at the given
+// offset on an 8-byte boundary: the joints of the nodes (numofDOFs doubles
+// each), the numNodes + 1 CSR offsets, the 2 numEdges edge targets, lengths and
+// checked flags, and the component root of every node.  Everything is in the
+// byte order of the machine that wrote it.
+typedef struct {
+    char magic[8]; // ROADMAP_FILE_MAGIC
+    uint32_t version;
+    uint32_t numofDOFs;
+    uint64_t mapHash; // hashWorldMap of the map the roadmap was built for
+    uint32_t linkLengthCells;
+    uint32_t numNodes;
+    uint32_t numEdges;
+    uint32_t reserved;
+    uint64_t jointsOffset;
+    uint64_t edgeOffsetsOffset;
+    uint64_t edgeTargetsOffset;
+    uint64_t edgeLengthsOffset;
+    uint64_t edgeCheckedOffset;
+    uint64_t componentsOffset;
+    uint64_t fileBytes;
+} RoadmapFileHeader;
 
-        int jointTransitionValid = isJointTransitionValid(closestNeighborDistance, discretizationStep, numofDOFs,
-                currJoint, closestNeighbor->joint, worldMap, x_size, y_size);
+// Maps the file at path into memory, copy on write so that edges can still be
+// marked checked, or reads it into the heap where there is no mmap.  Returns 0
+// if it cannot be opened.
+static void* mapRoadmapFile(const char* path, size_t* fileBytes) {
+#if defined(_WIN32)
+    FILE* f = fopen(path, "rb");
+    if (f == 0)
+        return 0;
+    fseek(f, 0, SEEK_END);
+    long bytes = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    void* file = malloc(MAX(bytes, 1));
+    if (bytes <= 0 || fread(file, 1, bytes, f) != (size_t) bytes) {
+        free(file);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+    *fileBytes = bytes;
+    return file;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    void* file = mmap(0, fileStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return 0;
+    *fileBytes = fileStat.st_size;
+    return file;
+#endif
+}
 
-        if (jointTransitionValid) {
+static void unmapRoadmapFile(void* file, size_t fileBytes) {
+#if defined(_WIN32)
+    free(file);
+#else
+    munmap(file, fileBytes);
+#endif
+}
 
-            vector<int>* nearNodeObstacleFree = new vector<int>();
+// Writes bytes of data at *offset, padded to the next 8-byte boundary, and
+// moves *offset past them
+static int writeRoadmapFileArray(FILE* f, const void* data, size_t bytes, uint64_t* offset) {
+    static const char padding[8] = {0};
+    size_t paddingBytes = (8 - bytes % 8) % 8;
+    *offset += bytes + paddingBytes;
+    return fwrite(data, 1, bytes, f) == bytes && fwrite(padding, 1, paddingBytes, f) == paddingBytes;
+}
 
-            Node* minNode = closestNeighbor;
-            double minCost = closestNeighbor->cost + closestNeighborDistance;
-            for (int i = 0; i < nearNodes->size(); i++) {
-                int jointTransitionValid = isJointTransitionValid((*nearNodeDistances)[i], discretizationStep, numofDOFs,
-                    currJoint, (*nearNodes)[i]->joint, worldMap, x_size, y_size);
-                
-                nearNodeObstacleFree->push_back(jointTransitionValid);
-                if (jointTransitionValid) {
-                    double currCost = (*nearNodes)[i]->cost + (*nearNodeDistances)[i];
-                    if (currCost < minCost) {
-                        minNode = (*nearNodes)[i];
-                        minCost = currCost;
-                    }
-                }
-            }
-            
-            Node* currNode = (Node*) malloc(sizeof(Node));
-            currNode->joint = currJoint;
-            currNode->parent = minNode;
-            currNode->nodeNum = minNode->nodeNum + 1;
-            currNode->cost = minCost;
-            nodes->push_back(currNode);
+// Saves roadmap, built for the map hashing to mapHash, to path.  It is written
+// to a temporary file first that then replaces path, so that a mapping of the
+// old file stays valid.  Returns whether that succeeded.
+static int saveRoadmapFile(Roadmap* roadmap, uint64_t mapHash, const char* path) {
+    compactRoadmap(roadmap);
+    RoadmapFileHeader header;
+    memset(&header, 0, sizeof(RoadmapFileHeader));
+    memcpy(header.magic, ROADMAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = ROADMAP_FILE_VERSION;
+    header.numofDOFs = roadmap->numofDOFs;
+    header.mapHash = mapHash;
+    header.linkLengthCells = LINKLENGTH_CELLS;
+    header.numNodes = roadmap->size;
+    header.numEdges = roadmap->numEdges;
 
-            for (int i = 0; i < nearNodes->size(); i++) {
-                if ((*nearNodes)[i] == minNode)
-                    continue;
-                double currCost = currNode->cost + (*nearNodeDistances)[i];
-                if ((*nearNodeObstacleFree)[i] && currCost < (*nearNodes)[i]->cost) {
-                    (*nearNodes)[i]->cost = currCost;
-                    (*nearNodes)[i]->parent = currNode;
-                    (*nearNodes)[i]->nodeNum = currNode->nodeNum + 1;
-                }
-            }
-            
-            if (numAfterGoal > 0)
-                numAfterGoal--;
-            if (numAfterGoal == 0)
-                break;
+    char* tempPath = (char*) malloc(strlen(path) + 5);
+    strcpy(tempPath, path);
+    strcat(tempPath, ".tmp");
+    FILE* f = fopen(tempPath, "wb");
+    if (f == 0) {
+        free(tempPath);
+        return 0;
+    }
+    int numEdgeEnds = 2 * roadmap->numEdges;
+    int* components = (int*) malloc(MAX(roadmap->size, 1) * sizeof(int));
+    for (int node = 0; node < roadmap->size; node++) {
+        components[node] = findRoadmapComponent(roadmap, node);
+    }
+    uint64_t offset = 0;
+    int written = writeRoadmapFileArray(f, &header, sizeof(RoadmapFileHeader), &offset);
+    header.jointsOffset = offset;
+    for (int node = 0; node < roadmap->size; node++) {
+        written = written && writeRoadmapFileArray(f, getRoadmapJoint(roadmap, node), roadmap->numofDOFs * sizeof(double), &offset);
+    }
+    header.edgeOffsetsOffset = offset;
+    written = written && writeRoadmapFileArray(f, roadmap->edgeOffsets, (roadmap->size + 1) * sizeof(int), &offset);
+    header.edgeTargetsOffset = offset;
+    written = written && writeRoadmapFileArray(f, roadmap->edgeTargets, numEdgeEnds * sizeof(int), &offset);
+    header.edgeLengthsOffset = offset;
+    written = written && writeRoadmapFileArray(f, roadmap->edgeLengths, numEdgeEnds * sizeof(float), &offset);
+    header.edgeCheckedOffset = offset;
+    written = written && writeRoadmapFileArray(f, roadmap->edgeChecked, numEdgeEnds, &offset);
+    header.componentsOffset = offset;
+    written = written && writeRoadmapFileArray(f, components, roadmap->size * sizeof(int), &offset);
+    header.fileBytes = offset;
+    written = written && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(RoadmapFileHeader), 1, f) == 1;
+    written = (fclose(f) == 0) && written;
+#if defined(_WIN32)
+    // rename does not replace files on Windows, and nothing maps path there
+    if (written)
+        remove(path);
+#endif
+    written = written && rename(tempPath, path) == 0;
+    if (!written)
+        remove(tempPath);
+    free(components);
+    free(tempPath);
+    return written;
+}
 
-            if (isGoalJoint) {
-                numAfterGoal = 1000; // Start the countdown!
-                //printf("Reached goalJoint -- expanding %d more nodes to improve path quality.\n", numAfterGoal);
-                goalNode = currNode;
-            }
+// Whether the array of bytes at offset lies on an 8-byte boundary within a
+// file of fileBytes, past its header
+static int roadmapFileSectionValid(uint64_t offset, uint64_t bytes, uint64_t fileBytes) {
+    return offset >= sizeof(RoadmapFileHeader) && offset % 8 == 0 && offset <= fileBytes && bytes <= fileBytes - offset;
+}
+
+// Whether the arrays of the roadmap file mapped at file, of fileBytes, can be
+// used as they are: each lies within the file without overlapping another, the
+// CSR offsets run from 0 to 2 numEdges without going down, and every edge
+// target and component root is a node.  The header must have been checked for
+// the DOF count already.
+static int roadmapFileValid(void* file, size_t fileBytes) {
+    RoadmapFileHeader* header = (RoadmapFileHeader*) file;
+    if (header->numNodes >= INT_MAX || header->numEdges > INT_MAX / 2)
+        return 0;
+    uint64_t numNodes = header->numNodes;
+    uint64_t numEdgeEnds = 2 * (uint64_t) header->numEdges;
+    uint64_t offsets[6] = {header->jointsOffset, header->edgeOffsetsOffset, header->edgeTargetsOffset,
+            header->edgeLengthsOffset, header->edgeCheckedOffset, header->componentsOffset};
+    uint64_t sizes[6] = {numNodes * header->numofDOFs * sizeof(double), (numNodes + 1) * sizeof(int),
+            numEdgeEnds * sizeof(int), numEdgeEnds * sizeof(float), numEdgeEnds, numNodes * sizeof(int)};
+    for (int i = 0; i < 6; i++) {
+        if (!roadmapFileSectionValid(offsets[i], sizes[i], fileBytes))
+            return 0;
+        for (int j = 0; j < i; j++) {
+            if (sizes[i] > 0 && sizes[j] > 0 && offsets[i] < offsets[j] + sizes[j] && offsets[j] < offsets[i] + sizes[i])
+                return 0;
         }
     }
-    Node* tempNode = goalNode;
-    int planLength = 1;
-    while(tempNode->parent != 0) {
-        planLength++;
-        tempNode = tempNode->parent;
+    char* bytes = (char*) file;
+    int* edgeOffsets = (int*) (bytes + header->edgeOffsetsOffset);
+    int* edgeTargets = (int*) (bytes + header->edgeTargetsOffset);
+    int* components = (int*) (bytes + header->componentsOffset);
+    if (edgeOffsets[0] != 0 || (uint64_t) edgeOffsets[numNodes] != numEdgeEnds)
+        return 0;
+    for (uint64_t node = 0; node < numNodes; node++) {
+        if (edgeOffsets[node + 1] < edgeOffsets[node])
+            return 0;
     }
-    //printf("Reached goalJoint -- building plan of length %d.\n", goalNode->nodeNum);
-    *plan = (double**) malloc(planLength * sizeof(double*));
-    *planlength = planLength;
+    for (uint64_t e = 0; e < numEdgeEnds; e++) {
+        if ((uint64_t) edgeTargets[e] >= numNodes)
+            return 0;
+    }
+    // roots only, so that findRoadmapComponent cannot loop
+    for (uint64_t node = 0; node < numNodes; node++) {
+        if ((uint64_t) components[node] >= numNodes || components[components[node]] != components[node])
+            return 0;
+    }
+    return 1;
+}
 
-    //printf("startNode = [%f, %f, %f, %f, %f]\n",
-    //        startNode->joint[0], startNode->joint[1], startNode->joint[2],
-    //        startNode->joint[3], startNode->joint[4]);
-    for (int i = *planlength - 1; i >= 0; i--) {
-        //printf("plan[%d] = [%f, %f, %f, %f, %f]\n",
-        //    i, goalNode->joint[0], goalNode->joint[1], goalNode->joint[2],
-        //        goalNode->joint[3], goalNode->joint[4]);
-        (*plan)[i] = (double*) malloc(numofDOFs * sizeof(double));
-        for(int j = 0; j < numofDOFs; j++){
-            (*plan)[i][j] = goalNode->joint[j];
-        }
-        goalNode = goalNode->parent;
+// Loads the roadmap saved at path if it was built for the map hashing to
+// mapHash, numofDOFs and LINKLENGTH_CELLS.  The joints and the CSR arrays are
+// used where the file is mapped; only the arrays kept per node are copied.
+// Returns 0 if there is no such file or roadmapFileValid rejects it, so that
+// the roadmap is built anew.
+static Roadmap* loadRoadmapFile(const char* path, uint64_t mapHash, int numofDOFs) {
+    size_t fileBytes;
+    void* file = mapRoadmapFile(path, &fileBytes);
+    if (file == 0)
+        return 0;
+    RoadmapFileHeader* header = (RoadmapFileHeader*) file;
+    if (fileBytes < sizeof(RoadmapFileHeader) || memcmp(header->magic, ROADMAP_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != ROADMAP_FILE_VERSION || header->fileBytes != fileBytes ||
+            header->mapHash != mapHash || header->numofDOFs != numofDOFs || header->linkLengthCells != LINKLENGTH_CELLS ||
+            !roadmapFileValid(file, fileBytes)) {
+        unmapRoadmapFile(file, fileBytes);
+        return 0;
     }
-    ExperimentResult result;
-    result.planningTime = (clock() - start ) / (double) CLOCKS_PER_SEC;
-    result.numNodes = nodes->size();
-    result.planLength = *planlength;
-    result.planQuality = getPlanQuality(plan, planlength, numofDOFs);
-    for(int i = 0; i < nodes->size(); i++) {
-        free((*nodes)[i]->joint);
-        free((*nodes)[i]);
+    char* bytes = (char*) file;
+    double* joints = (double*) (bytes + header->jointsOffset);
+    int* edgeOffsets = (int*) (bytes + header->edgeOffsetsOffset);
+    int* components = (int*) (bytes + header->componentsOffset);
+
+    Roadmap* roadmap = createRoadmap(numofDOFs);
+    reserveRoadmapNodes(roadmap, header->numNodes);
+    roadmap->size = header->numNodes;
+    roadmap->numEdges = header->numEdges;
+    for (int node = 0; node < roadmap->size; node++) {
+        roadmap->joints[node] = joints + node * numofDOFs;
+        roadmap->degree[node] = edgeOffsets[node + 1] - edgeOffsets[node];
+        roadmap->component[node] = components[node];
+        roadmap->componentRank[node] = 0;
+        roadmap->pathParent[node] = -1;
+        roadmap->nodeNum[node] = -1;
+        roadmap->firstBlock[node] = -1;
+        roadmap->overlayAdjacent[node] = 0;
+        roadmap->edgeOffsets[node] = edgeOffsets[node];
     }
-    //printf("Path has %d nodes and %d total nodes were generated in %f seconds with planQuality %f.\n", result.planLength, result.numNodes, result.planningTime, result.planQuality);
-    return result;
+    roadmap->edgeOffsets[roadmap->size] = edgeOffsets[roadmap->size];
+    roadmap->edgeTargets = (int*) (bytes + header->edgeTargetsOffset);
+    roadmap->edgeLengths = (float*) (bytes + header->edgeLengthsOffset);
+    roadmap->edgeChecked = (unsigned char*) (bytes + header->edgeCheckedOffset);
+    roadmap->compacted = 1;
+    roadmap->edgesInFile = 1;
+    roadmap->file = file;
+    roadmap->fileBytes = fileBytes;
+    return roadmap;
 }
 
-struct PRMNode {
-    double* joint;
-    vector<PRMNode*>* neighbors;
-    int connectedToStart;
-    int connectedToGoal;
+// Roadmap PRM keeps across mex calls for the map whose occupied cells hash to
+// mapHash.  The joints of the nodes it added live in arena.
+typedef struct {
+    uint64_t mapHash;
+    int numofDOFs;
+    Roadmap* roadmap;
+    NNIndex* index;
+    Arena* arena;
+    char* fileName; // roadmap file it was last loaded from or saved to, 0 if none
+    int changed; // whether it has nodes or checked edges that file does not
+} PersistentRoadmap;
 
-    PRMNode* neighborToStart;
-    int nodeNum;
-};
+static PersistentRoadmap* persistentRoadmap = 0;
 
-static void getNearPRMNodes(double* joint, vector<PRMNode*>* nodes, vector<PRMNode*>* nearNodes, vector<double>* nearNodeDistances, double radius, int numofDOFs) {
-    radius = pow(radius, 2);
-    for (int i = 0; i < nodes->size(); i++) {
-        PRMNode* neighbor = (*nodes)[i];
-        double* neighborJoint = neighbor->joint;
-        double currNeighborDistance = 0;
-        for (int j = 0; j < numofDOFs; j++) {
-            currNeighborDistance += pow(fabs(neighborJoint[j] - joint[j]), 2);
-        }
-        
-        if (currNeighborDistance <= radius) {
-            nearNodes->push_back(neighbor);
-            //printf("Added neighbor [%f, %f, %f, %f, %f]\n",
-            //    neighbor->joint[0], neighbor->joint[1], neighbor->joint[2], neighbor->joint[3], neighbor->joint[4]);
-            nearNodeDistances->push_back(sqrt(currNeighborDistance));
-        }
-    }
+static void freePersistentRoadmap() {
+    if (persistentRoadmap == 0)
+        return;
+    freeNNIndex(persistentRoadmap->index);
+    freeRoadmap(persistentRoadmap->roadmap);
+    freeArena(persistentRoadmap->arena);
+    free(persistentRoadmap->fileName);
+    free(persistentRoadmap);
+    persistentRoadmap = 0;
 }
 
-static int propagateStartGoalConnected(PRMNode* node) {
-    int startGoalConnected = (node->connectedToStart && node->connectedToGoal);
-    PRMNode* currNeighbor;
-    int currNeighborConnectedToStart;
-    int currNeighborConnectedToGoal;
-    for (int i = 0; i < node->neighbors->size(); i++) {
-        currNeighbor = (*(node->neighbors))[i];
-        currNeighborConnectedToStart = currNeighbor->connectedToStart;
-        currNeighborConnectedToGoal = currNeighbor->connectedToGoal;
-        currNeighbor->connectedToStart = (currNeighbor->connectedToStart || node->connectedToStart);
-        currNeighbor->connectedToGoal = (currNeighbor->connectedToGoal || node->connectedToGoal);
-        if (currNeighborConnectedToStart != node->connectedToStart || currNeighborConnectedToGoal != node->connectedToGoal) {
-            if(propagateStartGoalConnected(currNeighbor)) {
-                startGoalConnected = 1;
-            }
-        }
+// Replaces the persistent roadmap with roadmap.  MATLAB frees it when it
+// clears the mex file.
+static void setPersistentRoadmap(Roadmap* roadmap, uint64_t mapHash, int numofDOFs) {
+    freePersistentRoadmap();
+    persistentRoadmap = (PersistentRoadmap*) malloc(sizeof(PersistentRoadmap));
+    persistentRoadmap->mapHash = mapHash;
+    persistentRoadmap->numofDOFs = numofDOFs;
+    persistentRoadmap->roadmap = roadmap;
+    persistentRoadmap->index = createNNIndex(numofDOFs);
+    for (int node = 0; node < roadmap->size; node++) {
+        nnIndexAdd(persistentRoadmap->index, getRoadmapJoint(roadmap, node));
     }
-    return startGoalConnected;
+    persistentRoadmap->arena = createArena();
+    persistentRoadmap->fileName = 0;
+    persistentRoadmap->changed = 0;
+    mexAtExit(freePersistentRoadmap);
 }
 
-static ExperimentResult plannerPRM(double* worldMap, int x_size, int y_size,
-        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int numofDOFs,
+// Returns the roadmap kept for worldMap, starting an empty one (and dropping
+// the one kept for another map) if there is none
+static PersistentRoadmap* getPersistentRoadmap(WorldMap* worldMap, int numofDOFs) {
+    uint64_t mapHash = hashWorldMap(worldMap);
+    if (persistentRoadmap == 0 || persistentRoadmap->mapHash != mapHash || persistentRoadmap->numofDOFs != numofDOFs)
+        setPersistentRoadmap(createRoadmap(numofDOFs), mapHash, numofDOFs);
+    return persistentRoadmap;
+}
+
+// Makes the roadmap saved at fileName the persistent one, unless a roadmap for
+// worldMap is kept already.  Returns whether it was loaded.
+static int loadPersistentRoadmap(WorldMap* worldMap, int numofDOFs, const char* fileName) {
+    uint64_t mapHash = hashWorldMap(worldMap);
+    if (persistentRoadmap != 0 && persistentRoadmap->mapHash == mapHash && persistentRoadmap->numofDOFs == numofDOFs)
+        return 0;
+    Roadmap* roadmap = loadRoadmapFile(fileName, mapHash, numofDOFs);
+    if (roadmap == 0)
+        return 0;
+    setPersistentRoadmap(roadmap, mapHash, numofDOFs);
+    persistentRoadmap->fileName = strdup(fileName);
+    return 1;
+}
+
+// Saves the persistent roadmap to fileName if that file does not have it
+// already.  Returns whether it was written.
+static int savePersistentRoadmap(const char* fileName) {
+    if (persistentRoadmap == 0)
+        return 0;
+    if (!persistentRoadmap->changed && persistentRoadmap->fileName != 0 && strcmp(persistentRoadmap->fileName, fileName) == 0)
+        return 0;
+    if (!saveRoadmapFile(persistentRoadmap->roadmap, persistentRoadmap->mapHash, fileName))
+        return 0;
+    free(persistentRoadmap->fileName);
+    persistentRoadmap->fileName = strdup(fileName);
+    persistentRoadmap->changed = 0;
+    return 1;
+}
+
+// Zeroes the counters that describe a single query, for roadmaps that serve
+// several of them
+static void resetRoadmapQueryStats(Roadmap* roadmap, NNIndex* index) {
+    roadmap->numExpansions = 0;
+    roadmap->searchTime = 0;
+    roadmap->numPathEdgesChecked = 0;
+    roadmap->numPathEdgesReused = 0;
+    roadmap->numPathEdgesCut = 0;
+    index->numQueries = 0;
+    index->queryTime = 0;
+    index->numApproximateQueries = 0;
+    index->recallSamples = 0;
+    index->recallHits = 0;
+}
+
+template <int DOF>
+static ExperimentResult plannerPRMDOF(WorldMap* worldMap,
+        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int dynamicDOFs,
         double*** plan, int* planlength) {
 
+    const int numofDOFs = FIXED_DOFS(DOF, dynamicDOFs);
     clock_t start = clock();
+    resetCollisionStats(worldMap);
 
 	//no plan by default
 	*plan = NULL;
@@ -885,130 +4453,134 @@ static ExperimentResult plannerPRM(double* worldMap, int x_size, int y_size,
     int discretizationFactor = getAngleDiscretizationFactor(numofDOFs);
     double discretizationStep = (2 * PI)/discretizationFactor;
     double epsilon = PI/4;
+    double visibilityRadius = SPARSE_VISIBILITY_FRACTION * 2 * PI * sqrt((double) numofDOFs);
 
-    vector<PRMNode*>* nodes = new vector<PRMNode*>();
-
-    
-    PRMNode* startNode = (PRMNode*) malloc(sizeof(PRMNode));
-    double* startJoint = (double*) malloc(numofDOFs * sizeof(double));
-    for (int i = 0; i < numofDOFs; i++) {
-        startJoint[i] = armstart_anglesV_rad[i];
-    }
-    startNode->joint = startJoint;
-    startNode->connectedToStart = 1;
-    startNode->connectedToGoal = 0;
-    startNode->neighbors = new vector<PRMNode*>();
-    startNode->nodeNum = 1;
-    nodes->push_back(startNode);
+    PersistentRoadmap* persistent = PERSISTENT_ROADMAP ? getPersistentRoadmap(worldMap, numofDOFs) : 0;
+    Roadmap* roadmap = persistent ? persistent->roadmap : createRoadmap(numofDOFs);
+    NNIndex* index = persistent ? persistent->index : createNNIndex(numofDOFs);
+    Arena* arena = persistent ? persistent->arena : createArena();
+    resetRoadmapQueryStats(roadmap, index);
+    vector<int>* nearNodes = new vector<int>();
+    vector<double>* nearNodeDistances = new vector<double>();
 
-    PRMNode* goalNode = (PRMNode*) malloc(sizeof(PRMNode));
-    double* goalJoint = (double*) malloc(numofDOFs * sizeof(double));
-    for (int i = 0; i < numofDOFs; i++) {
-        goalJoint[i] = armgoal_anglesV_rad[i];
-    }
-    goalNode->joint = goalJoint;
-    goalNode->connectedToStart = 0;
-    goalNode->connectedToGoal = 1;
-    goalNode->neighbors = new vector<PRMNode*>();
-    goalNode->nodeNum = -1;
-    nodes->push_back(goalNode);
+    // the start and goal are overlay nodes 0 and 1, so a persistent roadmap
+    // only keeps the samples the query adds
+    addRoadmapOverlayNode<DOF>(armstart_anglesV_rad, roadmap, index, nearNodes, nearNodeDistances,
+            epsilon, discretizationStep, numofDOFs, worldMap);
+    addRoadmapOverlayNode<DOF>(armgoal_anglesV_rad, roadmap, index, nearNodes, nearNodeDistances,
+            epsilon, discretizationStep, numofDOFs, worldMap);
 
+    // a roadmap file needs saving again if the query samples or checks edges
+    int numStoredNodes = roadmap->size;
     double* currJoint;
+    int startGoalConnected = roadmapOverlayConnected(roadmap);
     while(1) {
-        if (((clock() - start ) / (double) CLOCKS_PER_SEC) > TIMELIMIT) {
+        int roadmapFull = persistent && !startGoalConnected && roadmap->size >= PERSISTENT_ROADMAP_MAX_NODES;
+        if (((clock() - start ) / (double) CLOCKS_PER_SEC) > TIMELIMIT || roadmapFull) {
+            delete nearNodes;
+            delete nearNodeDistances;
+            clearRoadmapOverlay(roadmap);
+            if (persistent && (roadmap->size > numStoredNodes || roadmap->numPathEdgesChecked > 0))
+                persistent->changed = 1;
+            if (!persistent) {
+                freeNNIndex(index);
+                freeRoadmap(roadmap);
+                freeArena(arena);
+            }
             ExperimentResult result;
             result.planningTime = -1;
             return result;
         }
-        currJoint = (double*) malloc(numofDOFs * sizeof(double));
+        if (startGoalConnected) {
+            if (searchRoadmap<DOF>(roadmap, roadmap->size, roadmap->size + 1) &&
+                    (!LAZY_EDGE_VALIDATION || validateRoadmapPath<DOF>(roadmap, roadmap->size + 1, discretizationStep, numofDOFs, worldMap)))
+                break;
+            // colliding edges were cut from the path, check whether another route remains
+            rebuildRoadmapComponents(roadmap);
+            startGoalConnected = roadmapOverlayConnected(roadmap);
+            continue;
+        }
+        currJoint = (double*) arenaAlloc(arena, numofDOFs * sizeof(double));
         generateRandomJoint(&currJoint, numofDOFs);
-        if(!IsValidArmConfiguration(currJoint, numofDOFs, worldMap, x_size, y_size))
+        if(!IsValidArmConfigurationCached<DOF>(currJoint, numofDOFs, worldMap)) {
+            arenaRelease(arena, currJoint);
             continue;
+        }
         //printf("currJoint is , [%f, %f, %f, %f, %f]\n",
         //    currJoint[0], currJoint[1], currJoint[2], currJoint[3], currJoint[4]);
 
-        vector<PRMNode*>* nearNodes = new vector<PRMNode*>();
-        vector<double>* nearNodeDistances = new vector<double>();
-        double radius = getRRTStarRadius(nodes->size(), numofDOFs, epsilon);
-        getNearPRMNodes(currJoint, nodes, nearNodes, nearNodeDistances, radius, numofDOFs);
-        // printf("Radius = %f, Num nearest nodes = %d, total num nodes = %d\n", radius, nearNodes->size(), nodes->size());
-
-        PRMNode* currNode = (PRMNode*) malloc(sizeof(PRMNode));
-        currNode->joint = currJoint;
-        currNode->connectedToStart = 0;
-        currNode->connectedToGoal = 0;
-        currNode->neighbors = new vector<PRMNode*>();
-        currNode->nodeNum = -1;
-        nodes->push_back(currNode);
-        // printf("currNode added to nodes\n");
-
-        PRMNode* neighbor;
-        double neighborDistance;
-        for(int i = 0; i < nearNodes->size(); i++) {
-            neighbor = (*nearNodes)[i];
-            neighborDistance = (*nearNodeDistances)[i];
-            //printf("neighbor is , [%f, %f, %f, %f, %f]\n",
-            //    neighbor->joint[0], neighbor->joint[1], neighbor->joint[2], neighbor->joint[3], neighbor->joint[4]);
-            if(!isJointTransitionValid(neighborDistance, discretizationStep, numofDOFs, currNode->joint, neighbor->joint, worldMap, x_size, y_size))
-                continue;
-            neighbor->neighbors->push_back(currNode);
-            currNode->neighbors->push_back(neighbor);
-        }
-        if (propagateStartGoalConnected(currNode))
-            break;
-    }
-    // printf("Start goal connected!  %d nodes expanded!", nodes->size());
-    
-    queue<PRMNode*> prmQueue;
-    prmQueue.push(startNode);
-            
-    PRMNode* currNode;
-    while(prmQueue.size() != 0) {
-        currNode = prmQueue.front();
-        prmQueue.pop();
-        if (currNode == goalNode) {
-            //printf("Found path to goalNode!\n");
-            break;
-        }
-        PRMNode* neighbor;
-        for(int i = 0; i < currNode->neighbors->size(); i++) {
-            neighbor = (*(currNode->neighbors))[i];
-            if (neighbor->nodeNum == -1) {
-                neighbor->neighborToStart = currNode;
-                neighbor->nodeNum = currNode->nodeNum + 1;
-                prmQueue.push(neighbor);
-            }
+        if (PRM_SPARSE) {
+            if (addSparseRoadmapSample<DOF>(currJoint, roadmap, index, nearNodes, nearNodeDistances, visibilityRadius,
+                    discretizationStep, numofDOFs, worldMap) == -1)
+                arenaRelease(arena, currJoint);
+            startGoalConnected = roadmapOverlayConnected(roadmap);
+            continue;
         }
+
+        connectRoadmapSample<DOF>(currJoint, roadmap, index, nearNodes, nearNodeDistances,
+                epsilon, discretizationStep, numofDOFs, worldMap);
+        startGoalConnected = roadmapOverlayConnected(roadmap);
     }
+    // printf("Start goal connected!  %d nodes expanded!", roadmap->size);
 
-    *plan = (double**) malloc(currNode->nodeNum * sizeof(double*));
-    *planlength = currNode->nodeNum;
+    int goalNode = roadmap->size + 1;
+    int currNode = goalNode;
+    *planlength = roadmap->nodeNum[goalNode];
+    *plan = (double**) malloc(*planlength * sizeof(double*));
 
     for (int i = *planlength - 1; i >= 0; i--) {
         (*plan)[i] = (double*) malloc(numofDOFs * sizeof(double));
+        double* joint = getRoadmapJoint(roadmap, currNode);
         for(int j = 0; j < numofDOFs; j++){
-            (*plan)[i][j] = currNode->joint[j];
+            (*plan)[i][j] = joint[j];
         }
-        currNode = currNode->neighborToStart;
+        currNode = roadmap->pathParent[currNode];
     }
-    
+
     ExperimentResult result;
     result.planningTime = (clock() - start ) / (double) CLOCKS_PER_SEC;
-    result.numNodes = nodes->size();
+    result.numNodes = roadmap->size + roadmap->numOverlayNodes;
     result.planLength = *planlength;
     result.planQuality = getPlanQuality(plan, planlength, numofDOFs);
+    result.numRoadmapEdges = roadmap->numEdges + roadmap->numOverlayEdges;
+    result.roadmapBytes = getRoadmapBytes(roadmap);
+    result.numSearchExpansions = roadmap->numExpansions;
+    result.searchTime = roadmap->searchTime;
+    result.numPathEdgesChecked = roadmap->numPathEdgesChecked;
+    result.numPathEdgesReused = roadmap->numPathEdgesReused;
+    result.numPathEdgesCut = roadmap->numPathEdgesCut;
+    result.numCoverageNodes = roadmap->numCoverageNodes;
+    result.numConnectivityNodes = roadmap->numConnectivityNodes;
+    result.numQualityNodes = roadmap->numQualityNodes;
+    result.numSamplesRejected = roadmap->numSamplesRejected;
+    recordCollisionStats(&result, worldMap);
+    recordNNStats(&result, index, 0);
+    recordArenaStats(&result, arena);
     //printf("Path has %d nodes and %d total nodes were generated in %f seconds with planQuality %f.\n", result.planLength, result.numNodes, result.planningTime, result.planQuality);
-    for(int i = 0; i < nodes->size(); i++) {
-        free((*nodes)[i]->joint);
-        free((*nodes)[i]);
+    delete nearNodes;
+    delete nearNodeDistances;
+    clearRoadmapOverlay(roadmap);
+    if (persistent && (roadmap->size > numStoredNodes || roadmap->numPathEdgesChecked > 0))
+        persistent->changed = 1;
+    if (!persistent) {
+        freeNNIndex(index);
+        freeRoadmap(roadmap);
+        freeArena(arena);
     }
     return result;
 }
 
+static ExperimentResult plannerPRM(WorldMap* worldMap,
+        double* armstart_anglesV_rad, double* armgoal_anglesV_rad, int numofDOFs,
+        double*** plan, int* planlength) {
+    DISPATCH_ON_DOF(numofDOFs, plannerPRMDOF, (worldMap, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, plan, planlength))
+}
+
 //prhs contains input parameters (3): 
 //1st is matrix with all the obstacles
 //2nd is a row vector of start angles for the arm 
 //3nd is a row vector of goal angles for the arm 
+//an optional 5th, after the planner id, names a roadmap file for PRM to load and save
 //plhs should contain output parameters (2): 
 //1st is a 2D matrix plan when each plan[i][j] is the value of jth angle at the ith step of the plan
 //(there are D DoF of the arm (that is, D angles). So, j can take values from 0 to D-1
@@ -1018,9 +4590,9 @@ void mexFunction( int nlhs, mxArray *plhs[],
 {
     
     /* Check for proper number of arguments */    
-    if (nrhs != 4) { 
+    if (nrhs != 4 && nrhs != 5) { 
 	    mexErrMsgIdAndTxt( "MATLAB:planner:invalidNumInputs",
-                "Four input arguments required."); 
+                "Four or five input arguments required."); 
     } else if (nlhs != 2) {
 	    mexErrMsgIdAndTxt( "MATLAB:planner:maxlhs",
                 "One output argument required."); 
@@ -1050,24 +4622,39 @@ void mexFunction( int nlhs, mxArray *plhs[],
 	    mexErrMsgIdAndTxt( "MATLAB:planner:invalidplanner_id",
                 "planner id should be between 0 and 4 inclusive");         
     }
+    char* roadmapFile = 0;
+    if (nrhs == 5) {
+        if (!mxIsChar(ROADMAP_FILE_IN)) {
+            mexErrMsgIdAndTxt( "MATLAB:planner:invalidRoadmapFile",
+                    "roadmap file should be a file name");
+        }
+        roadmapFile = mxArrayToString(ROADMAP_FILE_IN);
+    }
+    WorldMap* worldMap = createWorldMap(map, x_size, y_size);
     
     //call the planner
     double** plan = NULL;
     int planlength = 0;
     
     //you can may be call the corresponding planner function here
+    ExperimentResult result;
+    result.planningTime = -1;
     if (planner_id == RRT) {
         printf("Running RRT Planner\n");
-        plannerRRT(map,x_size,y_size, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, &plan, &planlength);
+        result = plannerRRT(worldMap, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, &plan, &planlength);
     } else if (planner_id == RRTCONNECT) {
         printf("Running RRT Connect Planner\n");
-        plannerRRTConnect(map,x_size,y_size, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, &plan, &planlength);
+        result = plannerRRTConnect(worldMap, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, &plan, &planlength);
     } else if (planner_id == RRTSTAR) {
         printf("Running RRT Star Planner\n");
-        plannerRRTStar(map,x_size,y_size, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, &plan, &planlength);
+        result = plannerRRTStar(worldMap, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, &plan, &planlength);
     } else if (planner_id == PRM) {
         printf("Running PRM Planner\n");
-        plannerPRM(map,x_size,y_size, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, &plan, &planlength);
+        if (PERSISTENT_ROADMAP && roadmapFile != 0 && loadPersistentRoadmap(worldMap, numofDOFs, roadmapFile))
+            printf("Loaded roadmap of %d nodes from %s\n", persistentRoadmap->roadmap->size, roadmapFile);
+        result = plannerPRM(worldMap, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, &plan, &planlength);
+        if (PERSISTENT_ROADMAP && roadmapFile != 0 && savePersistentRoadmap(roadmapFile))
+            printf("Saved roadmap of %d nodes to %s\n", persistentRoadmap->roadmap->size, roadmapFile);
     } else if (planner_id == ALL) {
         printf("Running All Planners\n");
         int numIterations = 20;
@@ -1075,18 +4662,30 @@ void mexFunction( int nlhs, mxArray *plhs[],
         double rrtPlanningTime = 0;
         int rrtNumNodes = 0;
         double rrtPlanQuality = 0;
+        long rrtEdgeStepsChecked = 0;
+        long rrtEdgeStepsSaved = 0;
+        double rrtNNRecall = 0;
 
         double rrtConnectPlanningTime = 0;
         int rrtConnectNumNodes = 0;
         double rrtConnectPlanQuality = 0;
+        long rrtConnectEdgeStepsChecked = 0;
+        long rrtConnectEdgeStepsSaved = 0;
+        double rrtConnectNNRecall = 0;
 
         double rrtStarPlanningTime = 0;
         int rrtStarNumNodes = 0;
         double rrtStarPlanQuality = 0;
+        long rrtStarEdgeStepsChecked = 0;
+        long rrtStarEdgeStepsSaved = 0;
+        double rrtStarNNRecall = 0;
 
         double prmPlanningTime = 0;
         int prmNumNodes = 0;
         double prmPlanQuality = 0;
+        long prmEdgeStepsChecked = 0;
+        long prmEdgeStepsSaved = 0;
+        double prmNNRecall = 0;
         
         srand(time(NULL));
         int i = 1;
@@ -1095,13 +4694,13 @@ void mexFunction( int nlhs, mxArray *plhs[],
             double* start = (double*) malloc(numofDOFs * sizeof(double));
             while(1) {
                 generateRandomJoint(&start, numofDOFs);
-                if(IsValidArmConfiguration(start, numofDOFs, map, x_size, y_size))
+                if(IsValidArmConfiguration(start, numofDOFs, worldMap))
                     break;
             }
             double* goal = (double*) malloc(numofDOFs * sizeof(double));
             while(1) {
                 generateRandomJoint(&goal, numofDOFs);
-                if(IsValidArmConfiguration(goal, numofDOFs, map, x_size, y_size))
+                if(IsValidArmConfiguration(goal, numofDOFs, worldMap))
                     break;
             }
             printf("start is  [");
@@ -1117,50 +4716,73 @@ void mexFunction( int nlhs, mxArray *plhs[],
             printf("%f]\n", goal[numofDOFs-1]);
 
             printf("Running RRT\n");
-            ExperimentResult rrtResult = plannerRRT(map,x_size,y_size, start, goal, numofDOFs, &plan, &planlength);
+            ExperimentResult rrtResult = plannerRRT(worldMap, start, goal, numofDOFs, &plan, &planlength);
             if (rrtResult.planningTime == -1) {
                 printf("RRT took more than %d seconds, retrying iteration...\n\n", TIMELIMIT);
                 continue;
             }
             printf("Running RRTConnect\n");
-            ExperimentResult rrtConnectResult = plannerRRTConnect(map,x_size,y_size, start, goal, numofDOFs, &plan, &planlength);
+            ExperimentResult rrtConnectResult = plannerRRTConnect(worldMap, start, goal, numofDOFs, &plan, &planlength);
             if (rrtConnectResult.planningTime == -1) {
                 printf("RRTConnect took more than %d seconds, retrying iteration...\n\n", TIMELIMIT);
                 continue;
             }
             printf("Running RRTStar\n");
-            ExperimentResult rrtStarResult = plannerRRTStar(map,x_size,y_size, start, goal, numofDOFs, &plan, &planlength);
+            ExperimentResult rrtStarResult = plannerRRTStar(worldMap, start, goal, numofDOFs, &plan, &planlength);
             if (rrtStarResult.planningTime == -1) {
                 printf("RRTStar took more than %d seconds, retrying iteration...\n\n", TIMELIMIT);
                 continue;
             }
+            if (LAZY_EDGE_VALIDATION && !planStartsAt(plan, planlength, start, numofDOFs)) {
+                mexErrMsgIdAndTxt( "MATLAB:planner:invalidPlan",
+                        "RRTStar plan does not start at the start angles");
+            }
             printf("Running PRM\n");
-            ExperimentResult prmResult = plannerPRM(map,x_size,y_size, start, goal, numofDOFs, &plan, &planlength);
+            // from an empty roadmap, so PRM's numbers compare with those of the tree planners
+            if (PERSISTENT_ROADMAP)
+                freePersistentRoadmap();
+            ExperimentResult prmResult = plannerPRM(worldMap, start, goal, numofDOFs, &plan, &planlength);
             if (prmResult.planningTime == -1) {
                 printf("PRM took more than %d seconds, retrying iteration...\n\n", TIMELIMIT);
                 continue;
             }
 
-            printf("Algorithm | planningTime | numNodes | planLength | planQuality\n");
+            printf("Algorithm | planningTime | numNodes | planLength | planQuality | edgeStepsChecked | edgeStepsSaved | nnQueryMicros | nnRecall\n");
             rrtPlanningTime += rrtResult.planningTime;
             rrtNumNodes += rrtResult.numNodes;
             rrtPlanQuality += rrtResult.planQuality;
-            printf("RRT | %f | %d | %d | %f\n", rrtResult.planningTime, rrtResult.numNodes, rrtResult.planLength, rrtResult.planQuality);
+            rrtEdgeStepsChecked += rrtResult.numEdgeStepsChecked;
+            rrtEdgeStepsSaved += rrtResult.numEdgeStepsSaved;
+            rrtNNRecall += rrtResult.nnRecall;
+            printf("RRT | %f | %d | %d | %f | %ld | %ld | %f | %f\n", rrtResult.planningTime, rrtResult.numNodes, rrtResult.planLength, rrtResult.planQuality,
+                    rrtResult.numEdgeStepsChecked, rrtResult.numEdgeStepsSaved, 1e6 * rrtResult.nnQueryTime / MAX(rrtResult.numNNQueries, 1), rrtResult.nnRecall);
             
             rrtConnectPlanningTime += rrtConnectResult.planningTime;
             rrtConnectNumNodes += rrtConnectResult.numNodes;
             rrtConnectPlanQuality += rrtConnectResult.planQuality;
-            printf("RRTConnect | %f | %d | %d | %f\n", rrtConnectResult.planningTime, rrtConnectResult.numNodes, rrtConnectResult.planLength, rrtConnectResult.planQuality);
+            rrtConnectEdgeStepsChecked += rrtConnectResult.numEdgeStepsChecked;
+            rrtConnectEdgeStepsSaved += rrtConnectResult.numEdgeStepsSaved;
+            rrtConnectNNRecall += rrtConnectResult.nnRecall;
+            printf("RRTConnect | %f | %d | %d | %f | %ld | %ld | %f | %f\n", rrtConnectResult.planningTime, rrtConnectResult.numNodes, rrtConnectResult.planLength, rrtConnectResult.planQuality,
+                    rrtConnectResult.numEdgeStepsChecked, rrtConnectResult.numEdgeStepsSaved, 1e6 * rrtConnectResult.nnQueryTime / MAX(rrtConnectResult.numNNQueries, 1), rrtConnectResult.nnRecall);
 
             rrtStarPlanningTime += rrtStarResult.planningTime;
             rrtStarNumNodes += rrtStarResult.numNodes;
             rrtStarPlanQuality += rrtStarResult.planQuality;
-            printf("RRTStar | %f | %d | %d | %f\n", rrtStarResult.planningTime, rrtStarResult.numNodes, rrtStarResult.planLength, rrtStarResult.planQuality);
+            rrtStarEdgeStepsChecked += rrtStarResult.numEdgeStepsChecked;
+            rrtStarEdgeStepsSaved += rrtStarResult.numEdgeStepsSaved;
+            rrtStarNNRecall += rrtStarResult.nnRecall;
+            printf("RRTStar | %f | %d | %d | %f | %ld | %ld | %f | %f\n", rrtStarResult.planningTime, rrtStarResult.numNodes, rrtStarResult.planLength, rrtStarResult.planQuality,
+                    rrtStarResult.numEdgeStepsChecked, rrtStarResult.numEdgeStepsSaved, 1e6 * rrtStarResult.nnQueryTime / MAX(rrtStarResult.numNNQueries, 1), rrtStarResult.nnRecall);
 
             prmPlanningTime += prmResult.planningTime;
             prmNumNodes += prmResult.numNodes;
             prmPlanQuality += prmResult.planQuality;
-            printf("PRM | %f | %d | %d | %f\n", prmResult.planningTime, prmResult.numNodes, prmResult.planLength, prmResult.planQuality);
+            prmEdgeStepsChecked += prmResult.numEdgeStepsChecked;
+            prmEdgeStepsSaved += prmResult.numEdgeStepsSaved;
+            prmNNRecall += prmResult.nnRecall;
+            printf("PRM | %f | %d | %d | %f | %ld | %ld | %f | %f\n", prmResult.planningTime, prmResult.numNodes, prmResult.planLength, prmResult.planQuality,
+                    prmResult.numEdgeStepsChecked, prmResult.numEdgeStepsSaved, 1e6 * prmResult.nnQueryTime / MAX(prmResult.numNNQueries, 1), prmResult.nnRecall);
             printf("-----------------------------------\n\n");
 
             i++;
@@ -1168,26 +4790,77 @@ void mexFunction( int nlhs, mxArray *plhs[],
         rrtPlanningTime /= numIterations;
         rrtNumNodes /= numIterations;
         rrtPlanQuality /= numIterations;
+        rrtEdgeStepsChecked /= numIterations;
+        rrtEdgeStepsSaved /= numIterations;
+        rrtNNRecall /= numIterations;
         rrtConnectPlanningTime /= numIterations;
         rrtConnectNumNodes /= numIterations;
         rrtConnectPlanQuality /= numIterations;
+        rrtConnectEdgeStepsChecked /= numIterations;
+        rrtConnectEdgeStepsSaved /= numIterations;
+        rrtConnectNNRecall /= numIterations;
         rrtStarPlanningTime /= numIterations;
         rrtStarNumNodes /= numIterations;
         rrtStarPlanQuality /= numIterations;
+        rrtStarEdgeStepsChecked /= numIterations;
+        rrtStarEdgeStepsSaved /= numIterations;
+        rrtStarNNRecall /= numIterations;
         prmPlanningTime /= numIterations;
         prmNumNodes /= numIterations;
         prmPlanQuality /= numIterations;
+        prmEdgeStepsChecked /= numIterations;
+        prmEdgeStepsSaved /= numIterations;
+        prmNNRecall /= numIterations;
         printf("Final Results!\n");
-        printf("Algorithm | avgPlanningTime | avgNumNodes |avgPlanQuality\n");
-        printf("RRT | %f | %d | %f\n", rrtPlanningTime, rrtNumNodes, rrtPlanQuality);
-        printf("RRTConnect | %f | %d | %f\n", rrtConnectPlanningTime, rrtConnectNumNodes, rrtConnectPlanQuality);
-        printf("RRTStar | %f | %d | %f\n", rrtStarPlanningTime, rrtStarNumNodes, rrtStarPlanQuality);
-        printf("PRM | %f | %d | %f\n", prmPlanningTime, prmNumNodes, prmPlanQuality);
+        printf("Algorithm | avgPlanningTime | avgNumNodes |avgPlanQuality | avgEdgeStepsChecked | avgEdgeStepsSaved | avgNNRecall\n");
+        printf("RRT | %f | %d | %f | %ld | %ld | %f\n", rrtPlanningTime, rrtNumNodes, rrtPlanQuality, rrtEdgeStepsChecked, rrtEdgeStepsSaved, rrtNNRecall);
+        printf("RRTConnect | %f | %d | %f | %ld | %ld | %f\n", rrtConnectPlanningTime, rrtConnectNumNodes, rrtConnectPlanQuality, rrtConnectEdgeStepsChecked, rrtConnectEdgeStepsSaved, rrtConnectNNRecall);
+        printf("RRTStar | %f | %d | %f | %ld | %ld | %f\n", rrtStarPlanningTime, rrtStarNumNodes, rrtStarPlanQuality, rrtStarEdgeStepsChecked, rrtStarEdgeStepsSaved, rrtStarNNRecall);
+        printf("PRM | %f | %d | %f | %ld | %ld | %f\n", prmPlanningTime, prmNumNodes, prmPlanQuality, prmEdgeStepsChecked, prmEdgeStepsSaved, prmNNRecall);
         printf("-----------------------------------\n\n");
     } else {
         printf("Running Dummy Planner\n");
         //dummy planner which only computes interpolated path
-        planner(map,x_size,y_size, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, &plan, &planlength);
+        planner(worldMap, armstart_anglesV_rad, armgoal_anglesV_rad, numofDOFs, &plan, &planlength);
+    }
+    if (LAZY_EDGE_VALIDATION && planlength > 0 && !planStartsAt(plan, planlength, armstart_anglesV_rad, numofDOFs)) {
+        mexErrMsgIdAndTxt( "MATLAB:planner:invalidPlan",
+                "plan does not start at the start angles");
+    }
+    if (planner_id < ALL) {
+        printf("Checked %ld edge steps, saved %ld\n", worldMap->stats.edgeStepsChecked,
+                worldMap->stats.edgeSteps - worldMap->stats.edgeStepsChecked);
+        if (CONFIG_CACHE_SIZE > 0) {
+            printf("Configuration cache: %ld hits, %ld misses, %ld evictions\n", worldMap->stats.configCacheHits,
+                    worldMap->stats.configCacheMisses, worldMap->stats.configCacheEvictions);
+        }
+        if (result.planningTime != -1) {
+            printf("Nearest neighbour index: %d nodes, %ld queries, %f us per query, recall %f\n", result.nnIndexSize,
+                    result.numNNQueries, 1e6 * result.nnQueryTime / MAX(result.numNNQueries, 1), result.nnRecall);
+        }
+        if (result.planningTime != -1) {
+            printf("Arena: %ld allocations, %ld KB in %ld heap blocks\n", result.numArenaAllocations,
+                    result.arenaBytes / 1024, result.numArenaHeapCalls);
+        }
+        if (result.planningTime != -1 && planner_id == PRM) {
+            printf("Roadmap: %d edges, %ld KB, searched with %ld expansions in %f ms\n", result.numRoadmapEdges,
+                    result.roadmapBytes / 1024, result.numSearchExpansions, 1e3 * result.searchTime);
+            if (LAZY_EDGE_VALIDATION) {
+                printf("Lazy PRM: checked %ld path edges, reused %ld, cut %ld\n", result.numPathEdgesChecked,
+                        result.numPathEdgesReused, result.numPathEdgesCut);
+            }
+            if (PRM_SPARSE) {
+                printf("Sparse PRM: %d coverage, %d connectivity and %d quality nodes, %ld samples rejected, stretch %.1f\n",
+                        result.numCoverageNodes, result.numConnectivityNodes, result.numQualityNodes,
+                        result.numSamplesRejected, SPARSE_STRETCH_FACTOR);
+            }
+        }
+        if (result.planningTime != -1 && planner_id == RRTSTAR) {
+            printf("RRT*: first solution cost %f, improved to %f\n", result.firstSolutionCost, result.planQuality);
+        }
+        if (PREFIX_CACHE_SIZE > 0 && planner_id == RRTCONNECT) {
+            printf("Prefix cache: %ld links reused\n", worldMap->stats.prefixLinksReused);
+        }
     }
     
     /* Create return values */
@@ -1222,6 +4895,8 @@ void mexFunction( int nlhs, mxArray *plhs[],
     unsigned short* planlength_out = (unsigned short*)mxGetData(PLANLENGTH_OUT);
     *planlength_out = planlength;
 
+    freeWorldMap(worldMap);
+    mxFree(roadmapFile);
     
     return;
     